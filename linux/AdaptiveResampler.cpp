@@ -0,0 +1,137 @@
+#include <OpenHome/Types.h>
+#include <OpenHome/Private/Standard.h>
+
+#include <climits>
+
+#include "AdaptiveResampler.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+
+// AdaptiveResampler
+
+const TUint64 AdaptiveResampler::kOne;
+
+AdaptiveResampler::AdaptiveResampler()
+{
+    Reset(2);
+}
+
+void AdaptiveResampler::Reset(TUint aChannels)
+{
+    ASSERT(aChannels >= 1 && aChannels <= kMaxChannels);
+
+    iChannels = aChannels;
+    iStep     = kOne;
+    iPosition = 0;
+    iHead     = 0;
+    iPrimed   = false;
+}
+
+TUint AdaptiveResampler::Channels() const
+{
+    return iChannels;
+}
+
+TUint AdaptiveResampler::DelayFrames() const
+{
+    // Output is interpolated between the middle two of the last four
+    // input frames.
+    return 2;
+}
+
+void AdaptiveResampler::SetRatePpb(TInt aPpb)
+{
+    iStep = kOne + (TInt64)(((TInt64)aPpb << 32) / 1000000000);
+}
+
+TUint AdaptiveResampler::Process(const TInt32* aIn, TUint& aInFrames,
+                                 TInt32* aOut, TUint aOutFrames)
+{
+    TUint consumed = 0;
+    TUint written  = 0;
+
+    if (!iPrimed)
+    {
+        if (aInFrames == 0)
+        {
+            return 0;
+        }
+
+        // Start with the window full of the first frame, rather than
+        // silence, so nothing is heard of the start up.
+        for (TUint i = 0; i < 4; i++)
+        {
+            for (TUint ch = 0; ch < iChannels; ch++)
+            {
+                iWindow[i][ch] = aIn[ch];
+            }
+        }
+
+        consumed = 1;
+        iPrimed  = true;
+    }
+
+    while (written < aOutFrames)
+    {
+        // Slide the window on until the output falls between its middle
+        // two frames.
+        while (iPosition >= kOne)
+        {
+            if (consumed == aInFrames)
+            {
+                aInFrames = consumed;
+                return written;
+            }
+
+            TInt32*       newest = iWindow[iHead];
+            const TInt32* frame  = aIn + consumed * iChannels;
+
+            for (TUint ch = 0; ch < iChannels; ch++)
+            {
+                newest[ch] = frame[ch];
+            }
+
+            iHead      = (iHead + 1) & 3;
+            iPosition -= kOne;
+            consumed++;
+        }
+
+        const TInt32* p0 = iWindow[iHead];
+        const TInt32* p1 = iWindow[(iHead + 1) & 3];
+        const TInt32* p2 = iWindow[(iHead + 2) & 3];
+        const TInt32* p3 = iWindow[(iHead + 3) & 3];
+        const double  t  = (double)iPosition / (double)kOne;
+
+        for (TUint ch = 0; ch < iChannels; ch++)
+        {
+            const double a = p0[ch];
+            const double b = p1[ch];
+            const double c = p2[ch];
+            const double d = p3[ch];
+
+            double v = b + 0.5 * t * (c - a +
+                       t * (2.0 * a - 5.0 * b + 4.0 * c - d +
+                       t * (3.0 * (b - c) + d - a)));
+
+            // The curve can overshoot full scale between samples.
+            if (v > INT_MAX)
+            {
+                v = INT_MAX;
+            }
+            else if (v < INT_MIN)
+            {
+                v = INT_MIN;
+            }
+
+            *aOut++ = (TInt32)v;
+        }
+
+        written++;
+        iPosition += iStep;
+    }
+
+    aInFrames = consumed;
+    return written;
+}
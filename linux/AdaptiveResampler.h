@@ -0,0 +1,47 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+
+namespace OpenHome {
+namespace Media {
+
+// AdaptiveResampler
+//
+// Plays interleaved 32 bit audio back a few hundred ppm faster or slower
+// than it arrives, so that a local DAC can follow a remote clock.
+//
+// Each output frame is a 4 point Catmull-Rom interpolation between input
+// frames, stepping through the input in 32.32 fixed point. At 0 ppb the
+// step is exactly one frame and the input passes through unchanged, two
+// frames late.
+
+class AdaptiveResampler
+{
+public:
+    static const TUint kMaxChannels = 8;
+public:
+    AdaptiveResampler();
+    void  Reset(TUint aChannels);
+    TUint Channels() const;
+    // The interpolator's delay, in input frames.
+    TUint DelayFrames() const;
+    // Positive rates consume input faster than real time.
+    void  SetRatePpb(TInt aPpb);
+    // Converts from aIn until either aInFrames have been consumed or
+    // aOutFrames written. aInFrames is updated to the number consumed and
+    // the number written is returned.
+    TUint Process(const TInt32* aIn, TUint& aInFrames,
+                  TInt32* aOut, TUint aOutFrames);
+private:
+    static const TUint64 kOne = 1ULL << 32;
+private:
+    TUint   iChannels;
+    TUint64 iStep;
+    TUint64 iPosition;                  // fraction past iWindow[1]
+    TInt32  iWindow[4][kMaxChannels];   // ring of the last 4 input frames
+    TUint   iHead;                      // oldest frame in iWindow
+    TBool   iPrimed;
+};
+
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,274 @@
+#include <OpenHome/Types.h>
+#include <OpenHome/Private/Printer.h>
+#include <alsa/asoundlib.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "AlsaDevice.h"
+#include "VirtualSink.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Configuration;
+using namespace OpenHome::Media;
+
+
+// ConfigAlsaDevice
+
+const Brn ConfigAlsaDevice::kKey("Alsa.Device");
+const TChar* ConfigAlsaDevice::kDefaultDevice = "default";
+
+ConfigAlsaDevice::ConfigAlsaDevice(IConfigInitialiser& aConfigInit)
+: iLock("ALDV")
+, iConfig(nullptr)
+, iSubscriberId(IConfigManager::kSubscriptionIdInvalid)
+, iSelected(0)
+{
+    Enumerate();
+
+    iConfig = new ConfigChoice(aConfigInit, kKey, iIds, Id(kDefaultDevice),
+                               *this);
+    iSubscriberId = iConfig->Subscribe(
+        MakeFunctorConfigChoice(*this, &ConfigAlsaDevice::DeviceChanged));
+}
+
+ConfigAlsaDevice::~ConfigAlsaDevice()
+{
+    iConfig->Unsubscribe(iSubscriberId);
+    delete iConfig;
+
+    for (TUint i = 0; i < iNames.size(); i++)
+    {
+        delete iNames[i];
+        delete iDescriptions[i];
+    }
+}
+
+void ConfigAlsaDevice::Add(IAlsaDeviceObserver& aObserver)
+{
+    AutoMutex _(iLock);
+    iObservers.push_back(&aObserver);
+    aObserver.AlsaDeviceChanged(*iNames[iSelected]);
+}
+
+void ConfigAlsaDevice::Remove(IAlsaDeviceObserver& aObserver)
+{
+    AutoMutex _(iLock);
+
+    for (auto it = iObservers.begin(); it != iObservers.end(); ++it)
+    {
+        if (*it == &aObserver)
+        {
+            iObservers.erase(it);
+            return;
+        }
+    }
+}
+
+void ConfigAlsaDevice::Device(Bwx& aDevice)
+{
+    AutoMutex _(iLock);
+    aDevice.Replace(*iNames[iSelected]);
+}
+
+void ConfigAlsaDevice::MixerCard(const Brx& aDevice, Bwx& aCard)
+{
+    // The mixer belongs to the card, so "plughw:CARD=Digi,DEV=0" and
+    // "hw:1,0" are controlled through "hw:CARD=Digi" and "hw:1". Devices
+    // that don't name a card use the default mixer.
+    const Brn   card("CARD=");
+    const TUint bytes = aDevice.Bytes();
+    TUint       start = bytes;
+
+    for (TUint i = 0; i + card.Bytes() <= bytes; i++)
+    {
+        if (aDevice.Split(i, card.Bytes()) == card)
+        {
+            start = i + card.Bytes();
+            break;
+        }
+    }
+
+    if (start == bytes &&
+        (aDevice.BeginsWith(Brn("hw:")) || aDevice.BeginsWith(Brn("plughw:"))))
+    {
+        start = 0;
+
+        while (aDevice[start] != ':')
+        {
+            start++;
+        }
+
+        start++;
+    }
+
+    if (start == bytes)
+    {
+        aCard.Replace(Brn(kDefaultDevice));
+        return;
+    }
+
+    TUint end = start;
+
+    while (end < bytes && aDevice[end] != ',')
+    {
+        end++;
+    }
+
+    aCard.Replace(Brn("hw:"));
+    aCard.Append(aDevice.Split(start, end - start));
+}
+
+void ConfigAlsaDevice::Write(IWriter& aWriter,
+                             IConfigChoiceMappingWriter& aMappingWriter)
+{
+    for (TUint i = 0; i < iIds.size(); i++)
+    {
+        // "<name> (<description>)", cut short if it won't fit.
+        Bws<kMaxMappingBytes> mapping;
+
+        Append(mapping, *iNames[i]);
+
+        if (iDescriptions[i]->Bytes() > 0)
+        {
+            Append(mapping, Brn(" ("));
+            Append(mapping, *iDescriptions[i]);
+            Append(mapping, Brn(")"));
+        }
+
+        aMappingWriter.Write(aWriter, iIds[i], mapping);
+    }
+
+    aMappingWriter.WriteComplete(aWriter);
+}
+
+void ConfigAlsaDevice::Enumerate()
+{
+    AddDevice(kDefaultDevice, "Default output");
+
+    void** hints;
+
+    if (snd_device_name_hint(-1, "pcm", &hints) < 0)
+    {
+        Log::Print("ConfigAlsaDevice: Cannot enumerate PCM devices\n");
+        AddVirtualSinks();
+        return;
+    }
+
+    // Direct hardware devices first, then anything else that plays.
+    for (TUint pass = 0; pass < 2; pass++)
+    {
+        for (void** hint = hints; *hint != nullptr; hint++)
+        {
+            TChar* name = snd_device_name_get_hint(*hint, "NAME");
+            TChar* desc = snd_device_name_get_hint(*hint, "DESC");
+            TChar* ioid = snd_device_name_get_hint(*hint, "IOID");
+
+            const TBool output = (ioid == nullptr ||
+                                  strcmp(ioid, "Output") == 0);
+            const TBool direct = (name != nullptr &&
+                                  (strncmp(name, "hw:", 3) == 0 ||
+                                   strncmp(name, "plughw:", 7) == 0));
+
+            if (name != nullptr && output && direct == (pass == 0) &&
+                strcmp(name, kDefaultDevice) != 0 &&
+                strcmp(name, "null") != 0)
+            {
+                AddDevice(name, desc);
+            }
+
+            free(name);
+            free(desc);
+            free(ioid);
+        }
+    }
+
+    snd_device_name_free_hint(hints);
+
+    AddVirtualSinks();
+
+    for (const Bwh* name : iNames)
+    {
+        Log::Print("ConfigAlsaDevice: %.*s\n", PBUF(*name));
+    }
+}
+
+void ConfigAlsaDevice::AddVirtualSinks()
+{
+    // Last, as they play nothing aloud.
+    for (TUint i = 0; i < VirtualSink::kDeviceCount; i++)
+    {
+        AddDevice(VirtualSink::kDevices[i], VirtualSink::kDescriptions[i]);
+    }
+}
+
+void ConfigAlsaDevice::AddDevice(const TChar* aName, const TChar* aDescription)
+{
+    const TUint id = Id(aName);
+
+    for (TUint existing : iIds)
+    {
+        if (existing == id)
+        {
+            return;
+        }
+    }
+
+    // Only the first line of a description is a name; the rest is detail.
+    TUint descriptionBytes = 0;
+
+    if (aDescription != nullptr)
+    {
+        const TChar* newline = strchr(aDescription, '\n');
+        descriptionBytes = (newline != nullptr) ?
+                               (TUint)(newline - aDescription) :
+                               (TUint)strlen(aDescription);
+    }
+
+    iNames.push_back(new Bwh(Brn(aName)));
+    iDescriptions.push_back(
+        new Bwh(Brn((const TByte*)aDescription, descriptionBytes)));
+    iIds.push_back(id);
+}
+
+void ConfigAlsaDevice::DeviceChanged(KeyValuePair<TUint>& aKvp)
+{
+    AutoMutex _(iLock);
+
+    for (TUint i = 0; i < iIds.size(); i++)
+    {
+        if (iIds[i] == aKvp.Value())
+        {
+            iSelected = i;
+            break;
+        }
+    }
+
+    const Brx& device = *iNames[iSelected];
+
+    Log::Print("ConfigAlsaDevice: Output device %.*s\n", PBUF(device));
+
+    for (IAlsaDeviceObserver* observer : iObservers)
+    {
+        observer->AlsaDeviceChanged(device);
+    }
+}
+
+void ConfigAlsaDevice::Append(Bwx& aBuf, const Brx& aText)
+{
+    const TUint bytes = std::min(aText.Bytes(), aBuf.MaxBytes() - aBuf.Bytes());
+    aBuf.Append(aText.Split(0, bytes));
+}
+
+TUint ConfigAlsaDevice::Id(const TChar* aDevice)
+{
+    // FNV-1a
+    TUint hash = 2166136261u;
+
+    for (const TChar* p = aDevice; *p != '\0'; p++)
+    {
+        hash = (hash ^ (TByte)*p) * 16777619u;
+    }
+
+    return hash;
+}
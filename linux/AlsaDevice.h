@@ -0,0 +1,71 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Configuration/ConfigManager.h>
+#include <OpenHome/Private/Thread.h>
+
+#include <vector>
+
+namespace OpenHome {
+namespace Media {
+
+// IAlsaDeviceObserver
+//
+// Told the name of the ALSA PCM to use, when it is first known and each
+// time the user picks another. May be called on any thread.
+
+class IAlsaDeviceObserver
+{
+public:
+    virtual void AlsaDeviceChanged(const Brx& aDevice) = 0;
+    virtual ~IAlsaDeviceObserver() {}
+};
+
+// ConfigAlsaDevice
+//
+// Config store backed choice of ALSA output device.
+//
+// The choices are "default" followed by the PCMs ALSA enumerates and then
+// the VirtualSink outputs. The hw: and plughw: devices are listed first as
+// they bypass the dmix, dsnoop and sound server layers that "default"
+// usually routes through. Choice values
+// are a hash of the device name so a stored choice survives devices coming
+// and going.
+
+class ConfigAlsaDevice : private Configuration::IConfigChoiceMapper
+{
+public:
+    static const Brn kKey;
+    static const TChar* kDefaultDevice;
+    static const TUint kMaxMappingBytes = 256;
+public:
+    ConfigAlsaDevice(Configuration::IConfigInitialiser& aConfigInit);
+    ~ConfigAlsaDevice();
+    void Add(IAlsaDeviceObserver& aObserver);
+    void Remove(IAlsaDeviceObserver& aObserver);
+    void Device(Bwx& aDevice);
+    static void MixerCard(const Brx& aDevice, Bwx& aCard);
+    static TUint Id(const TChar* aDevice);
+private: // from IConfigChoiceMapper
+    void Write(IWriter& aWriter,
+               Configuration::IConfigChoiceMappingWriter& aMappingWriter) override;
+private:
+    void Enumerate();
+    void AddVirtualSinks();
+    void AddDevice(const TChar* aName, const TChar* aDescription);
+    void DeviceChanged(Configuration::KeyValuePair<TUint>& aKvp);
+    static void Append(Bwx& aBuf, const Brx& aText);
+private:
+    Mutex                             iLock;
+    std::vector<Bwh*>                 iNames;
+    std::vector<Bwh*>                 iDescriptions;
+    std::vector<TUint>                iIds;
+    std::vector<IAlsaDeviceObserver*> iObservers;
+    Configuration::ConfigChoice*      iConfig;
+    TUint                             iSubscriberId;
+    TUint                             iSelected;
+};
+
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,273 @@
+#include <OpenHome/Types.h>
+#include <OpenHome/Buffer.h>
+
+#include <climits>
+
+#include "AlsaStats.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+
+// LatencyHistogram
+
+LatencyHistogram::LatencyHistogram()
+{
+    Reset();
+}
+
+void LatencyHistogram::Record(TUint aUs)
+{
+    TUint bucket = 0;
+
+    if (aUs != 0)
+    {
+        bucket = 32 - __builtin_clz(aUs);
+
+        if (bucket >= kBuckets)
+        {
+            bucket = kBuckets - 1;
+        }
+    }
+
+    iBuckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    iCount.fetch_add(1, std::memory_order_relaxed);
+    iTotalUs.fetch_add(aUs, std::memory_order_relaxed);
+
+    TUint max = iMaxUs.load(std::memory_order_relaxed);
+    while (aUs > max &&
+           !iMaxUs.compare_exchange_weak(max, aUs, std::memory_order_relaxed))
+    {
+    }
+}
+
+void LatencyHistogram::Reset()
+{
+    for (TUint i = 0; i < kBuckets; i++)
+    {
+        iBuckets[i] = 0;
+    }
+
+    iCount   = 0;
+    iMaxUs   = 0;
+    iTotalUs = 0;
+}
+
+void LatencyHistogram::Write(IWriter& aWriter, const TChar* aName) const
+{
+    const TUint count = iCount;
+    Bws<128>    line;
+
+    line.AppendPrintf("%s: %u samples, mean %u us, max %u us\n", aName,
+                      count, count ? (TUint)(iTotalUs / count) : 0,
+                      (TUint)iMaxUs);
+    aWriter.Write(line);
+
+    for (TUint i = 0; i < kBuckets; i++)
+    {
+        const TUint n = iBuckets[i];
+
+        if (n == 0)
+        {
+            continue;
+        }
+
+        line.SetBytes(0);
+
+        if (i == 0)
+        {
+            line.AppendPrintf("  %10s %10u\n", "0 us", n);
+        }
+        else if (i == kBuckets - 1)
+        {
+            line.AppendPrintf("  >= %7u us %10u\n", 1u << (i - 1), n);
+        }
+        else
+        {
+            line.AppendPrintf("  < %8u us %10u\n", 1u << i, n);
+        }
+
+        aWriter.Write(line);
+    }
+}
+
+
+// DriverHealth
+
+DriverHealth::DriverHealth()
+: iDeviceLock("ALDH")
+{
+    Reset();
+}
+
+void DriverHealth::Opened(const Brx& aDevice, const Brx& aRequested)
+{
+    AutoMutex _(iDeviceLock);
+
+    iDevice.Replace(aDevice);
+
+    if (aDevice == aRequested)
+    {
+        iRequested.SetBytes(0);
+    }
+    else
+    {
+        iRequested.Replace(aRequested);
+        iFallbacks++;
+    }
+}
+
+void DriverHealth::Xrun()
+{
+    iXruns++;
+}
+
+void DriverHealth::ShortWrite()
+{
+    iShortWrites++;
+}
+
+void DriverHealth::Recovery(TBool aRecovered)
+{
+    if (aRecovered)
+    {
+        iRecoveries++;
+    }
+    else
+    {
+        iRecoveryFailures++;
+    }
+}
+
+void DriverHealth::Drained(TUint aUs)
+{
+    iDrains++;
+    iLastDrainUs = aUs;
+
+    if (aUs > iMaxDrainUs)
+    {
+        iMaxDrainUs = aUs;
+    }
+}
+
+void DriverHealth::Period(TInt aAvail, TInt aDelay)
+{
+    iPeriods.fetch_add(1, std::memory_order_relaxed);
+    iLastAvail.store(aAvail, std::memory_order_relaxed);
+    iLastDelay.store(aDelay, std::memory_order_relaxed);
+
+    // Only the thread writing to the device records periods.
+    if (aDelay < iMinDelay.load(std::memory_order_relaxed))
+    {
+        iMinDelay.store(aDelay, std::memory_order_relaxed);
+    }
+}
+
+void DriverHealth::PoweredDown()
+{
+    iPowerDowns++;
+}
+
+LatencyHistogram& DriverHealth::PullWait()
+{
+    return iPullWait;
+}
+
+LatencyHistogram& DriverHealth::WriteBlock()
+{
+    return iWriteBlock;
+}
+
+LatencyHistogram& DriverHealth::SeekToSound()
+{
+    return iSeekToSound;
+}
+
+LatencyHistogram& DriverHealth::SkipToSound()
+{
+    return iSkipToSound;
+}
+
+LatencyHistogram& DriverHealth::ColdStart()
+{
+    return iColdStart;
+}
+
+void DriverHealth::Reset()
+{
+    iXruns            = 0;
+    iShortWrites      = 0;
+    iRecoveries       = 0;
+    iRecoveryFailures = 0;
+    iDrains           = 0;
+    iLastDrainUs      = 0;
+    iMaxDrainUs       = 0;
+    iPeriods          = 0;
+    iLastAvail        = 0;
+    iLastDelay        = 0;
+    iMinDelay         = INT_MAX;
+    iPowerDowns       = 0;
+    iFallbacks        = 0;
+
+    iPullWait.Reset();
+    iWriteBlock.Reset();
+    iSeekToSound.Reset();
+    iSkipToSound.Reset();
+    iColdStart.Reset();
+}
+
+void DriverHealth::Write(IWriter& aWriter) const
+{
+    const TInt minDelay = iMinDelay;
+    Bws<128>   line;
+
+    {
+        AutoMutex _(iDeviceLock);
+        Bws<kMaxDeviceBytes * 2 + 64> device;
+
+        device.AppendPrintf("Device:                  %.*s\n",
+                            PBUF(iDevice));
+
+        if (iRequested.Bytes() != 0)
+        {
+            device.AppendPrintf("  in place of %.*s, which failed to open\n",
+                                PBUF(iRequested));
+        }
+
+        aWriter.Write(device);
+    }
+
+    line.AppendPrintf("Fallbacks:               %u\n", (TUint)iFallbacks);
+    aWriter.Write(line);
+    line.SetBytes(0);
+
+    line.AppendPrintf("Xruns:                   %u\n", (TUint)iXruns);
+    aWriter.Write(line);
+    line.SetBytes(0);
+    line.AppendPrintf("Short writes:            %u\n", (TUint)iShortWrites);
+    aWriter.Write(line);
+    line.SetBytes(0);
+    line.AppendPrintf("Recoveries:              %u (%u failed)\n",
+                      (TUint)iRecoveries, (TUint)iRecoveryFailures);
+    aWriter.Write(line);
+    line.SetBytes(0);
+    line.AppendPrintf("Drains:                  %u, last %u us, max %u us\n",
+                      (TUint)iDrains, (TUint)iLastDrainUs,
+                      (TUint)iMaxDrainUs);
+    aWriter.Write(line);
+    line.SetBytes(0);
+    line.AppendPrintf("Periods:                 %u, avail %d, delay %d, "
+                      "min delay %d frames\n",
+                      (TUint)iPeriods, (TInt)iLastAvail, (TInt)iLastDelay,
+                      minDelay == INT_MAX ? 0 : minDelay);
+    aWriter.Write(line);
+    line.SetBytes(0);
+    line.AppendPrintf("Power downs:             %u\n", (TUint)iPowerDowns);
+    aWriter.Write(line);
+
+    iPullWait.Write(aWriter, "Pull wait");
+    iWriteBlock.Write(aWriter, "Write block");
+    iSeekToSound.Write(aWriter, "Seek to sound");
+    iSkipToSound.Write(aWriter, "Skip to sound");
+    iColdStart.Write(aWriter, "Cold start");
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Thread.h>
+
+#include <atomic>
+
+namespace OpenHome {
+namespace Media {
+
+// LatencyHistogram
+//
+// Counts of durations in power of two microsecond buckets. Bucket 0 holds
+// 0 us and bucket n holds [2^(n-1), 2^n) us, with the last bucket also
+// taking everything longer. Safe to record from one thread while another
+// reads or resets.
+
+class LatencyHistogram
+{
+    static const TUint kBuckets = 22;
+public:
+    LatencyHistogram();
+    void Record(TUint aUs);
+    void Reset();
+    void Write(IWriter& aWriter, const TChar* aName) const;
+private:
+    std::atomic<TUint>   iBuckets[kBuckets];
+    std::atomic<TUint>   iCount;
+    std::atomic<TUint>   iMaxUs;
+    std::atomic<TUint64> iTotalUs;
+};
+
+// DriverHealth
+//
+// What went wrong at the device and how long the driver spent waiting,
+// for the "alsa" shell command. Also which device is open, and the one
+// asked for when it couldn't be and another was opened in its place.
+
+class DriverHealth
+{
+    static const TUint kMaxDeviceBytes = 256;
+public:
+    DriverHealth();
+    void Opened(const Brx& aDevice, const Brx& aRequested);
+    void Xrun();
+    void ShortWrite();
+    void Recovery(TBool aRecovered);
+    void Drained(TUint aUs);
+    void Period(TInt aAvail, TInt aDelay);
+    void PoweredDown();
+    LatencyHistogram& PullWait();
+    LatencyHistogram& WriteBlock();
+    LatencyHistogram& SeekToSound();
+    LatencyHistogram& SkipToSound();
+    LatencyHistogram& ColdStart();
+    void Reset();
+    void Write(IWriter& aWriter) const;
+private:
+    std::atomic<TUint> iXruns;
+    std::atomic<TUint> iShortWrites;
+    std::atomic<TUint> iRecoveries;
+    std::atomic<TUint> iRecoveryFailures;
+    std::atomic<TUint> iDrains;
+    std::atomic<TUint> iLastDrainUs;
+    std::atomic<TUint> iMaxDrainUs;
+    std::atomic<TUint> iPeriods;
+    std::atomic<TInt>  iLastAvail;
+    std::atomic<TInt>  iLastDelay;
+    std::atomic<TInt>  iMinDelay;     // closest playback came to running dry
+    std::atomic<TUint> iPowerDowns;
+    std::atomic<TUint> iFallbacks;
+    mutable Mutex      iDeviceLock;
+    Bws<kMaxDeviceBytes> iDevice;
+    Bws<kMaxDeviceBytes> iRequested;    // empty unless iDevice replaced it
+    LatencyHistogram   iPullWait;
+    LatencyHistogram   iWriteBlock;
+    LatencyHistogram   iSeekToSound;    // queued audio discarded to playing
+    LatencyHistogram   iSkipToSound;
+    LatencyHistogram   iColdStart;      // reopening after powering down
+};
+
+} // namespace Media
+} // namespace OpenHome
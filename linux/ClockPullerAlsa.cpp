@@ -0,0 +1,76 @@
+#include <OpenHome/Types.h>
+#include <OpenHome/Media/Pipeline/Msg.h>
+#include <OpenHome/Private/Printer.h>
+
+#include <algorithm>
+
+#include "ClockPullerAlsa.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+
+// ClockPullerAlsa
+
+// A millisecond of error asks for 100 ppm, working it off in around ten
+// seconds, while the integral term takes out the steady drift between
+// the two crystals, typically a few tens of ppm.
+static const TInt64 kProportionalPpbPerUs = 100;
+static const TInt64 kIntegralPpbPerUs     = 1;
+
+ClockPullerAlsa::ClockPullerAlsa()
+: iLock("CPAL")
+, iActive(false)
+, iRatePpb(0)
+, iIntegralUs(0)
+{
+}
+
+TBool ClockPullerAlsa::Active() const
+{
+    return iActive;
+}
+
+TInt ClockPullerAlsa::RatePpb() const
+{
+    return iRatePpb;
+}
+
+void ClockPullerAlsa::Update(TInt aDelta)
+{
+    const TInt64 errorUs =
+        ((TInt64)aDelta * 1000000) / Jiffies::kPerSecond;
+    const TInt64 limit   = kMaxPpb / kIntegralPpbPerUs;
+
+    AutoMutex _(iLock);
+
+    iIntegralUs = std::min(std::max(iIntegralUs + errorUs, -limit), limit);
+
+    TInt64 ppb = errorUs * kProportionalPpbPerUs +
+                 iIntegralUs * kIntegralPpbPerUs;
+
+    ppb = std::min(std::max(ppb, (TInt64)-kMaxPpb), (TInt64)kMaxPpb);
+
+    iRatePpb = (TInt)ppb;
+}
+
+void ClockPullerAlsa::Start()
+{
+    Log::Print("ClockPullerAlsa: Start\n");
+
+    AutoMutex _(iLock);
+
+    iIntegralUs = 0;
+    iRatePpb    = 0;
+    iActive     = true;
+}
+
+void ClockPullerAlsa::Stop()
+{
+    Log::Print("ClockPullerAlsa: Stop\n");
+
+    AutoMutex _(iLock);
+
+    iActive  = false;
+    iRatePpb = 0;
+}
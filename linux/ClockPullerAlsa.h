@@ -0,0 +1,47 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+#include <OpenHome/Media/ClockPuller.h>
+#include <OpenHome/Private/Thread.h>
+
+#include <atomic>
+
+namespace OpenHome {
+namespace Media {
+
+// ClockPullerAlsa
+//
+// Keeps a Songcast receiver locked to its sender by nudging the rate
+// DriverAlsa plays at.
+//
+// The receiver reports through Update() how far, in jiffies, the audio it
+// holds is from where it should be. That error is what the sender's
+// timestamps make of our DAC, as driven by the ALSA hardware pointer. A
+// proportional-integral loop turns it into a rate correction in parts
+// per billion which DriverAlsa applies with its AdaptiveResampler. A
+// positive correction plays faster to work off a surplus.
+//
+// Rate() and Active() are read by the PipelineAnimator; Update(), Start()
+// and Stop() come from the receiver's threads, and may race each other.
+// The loop's state is updated under iLock.
+
+class ClockPullerAlsa : public IClockPuller
+{
+    static const TInt kMaxPpb = 500000;     // +/- 500 ppm
+public:
+    ClockPullerAlsa();
+    TBool Active() const;
+    TInt  RatePpb() const;
+public: // from IClockPuller
+    void Update(TInt aDelta) override;
+    void Start() override;
+    void Stop() override;
+private:
+    Mutex              iLock;
+    std::atomic<TBool> iActive;
+    std::atomic<TInt>  iRatePpb;
+    TInt64             iIntegralUs;
+};
+
+} // namespace Media
+} // namespace OpenHome
@@ -1,15 +1,40 @@
 #include <OpenHome/Private/Printer.h>
 #include <OpenHome/Net/Private/Globals.h>
 #include <OpenHome/OsWrapper.h>
+#include <OpenHome/Private/Shell.h>
 #include <alsa/asoundlib.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
-
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "AdaptiveResampler.h"
+#include "AlsaStats.h"
+#include "ClockPullerAlsa.h"
 #include "DriverAlsa.h"
+#include "PcmKernels.h"
+#include "PcmRing.h"
+#include "PolyphaseResampler.h"
+#include "RealtimePolicy.h"
+#include "VirtualSink.h"
 
 using namespace OpenHome;
 using namespace OpenHome::Media;
 
 
+static TUint MicrosecondsSince(std::chrono::steady_clock::time_point aStart)
+{
+    return (TUint)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - aStart).count();
+}
+
+
 PriorityArbitratorDriver::PriorityArbitratorDriver(TUint aOpenHomeMax)
 : iOpenHomeMax(aOpenHomeMax)
 {
@@ -36,577 +61,1409 @@ TUint PriorityArbitratorDriver::HostRange() const
     return 1;
 }
 
+// IDataSink
+//
+// Where PcmProcessorAlsa puts converted audio. Acquire() returns space for
+// up to aBytes of output, reducing aBytes if less is free, or nullptr if
+// the audio should be dropped. It waits rather than return less than a
+// frame, so the converter always makes progress. Commit() then queues the
+// first aBytes of it for playback.
+
 class IDataSink
 {
 public:
-    virtual void Write(const Brx& aData) = 0;
-    virtual     ~IDataSink() {}
+    virtual TByte* Acquire(TUint& aBytes) = 0;
+    virtual void   Commit(TUint aBytes) = 0;
+    virtual        ~IDataSink() {}
 };
 
-// PcmProcessorBase
-
-class PcmProcessorBase : public IPcmProcessor
+// ConversionArena
+//
+// Scratch space PCM is converted into before snd_pcm_writei(). Fragments
+// are gathered here until a whole ALSA period is ready. It is sized at the
+// start of each stream for one period, so the render path on the
+// PipelineAnimator thread never touches the heap.
+//
+// Only snd_pcm_writei() from the animator thread uses it. mmap access
+// converts straight into the mmap area, and with a ring between the
+// animator and the writer thread PCM is converted straight into the ring,
+// itself sized at the start of the stream. Nothing is reserved for either.
+//
+// Should a fragment ever exceed the reserved size the arena grows and the
+// event is counted, so it can be checked from the shell.
+
+class ConversionArena
 {
-protected:
-    PcmProcessorBase(IDataSink& aDataSink, Bwx& aBuffer);
-public: // IPcmProcessor
-    virtual void BeginBlock();
-    void ProcessFragment(const Brx& aData, TUint aNumChannels, TUint aSubsampleBytes) override;
-    void ProcessSilence(const Brx& aData, TUint aNumChannels, TUint aSubsampleBytes) override;
-    virtual void EndBlock();
-    virtual void Flush();
 public:
-    void SetDuplicateChannel(TBool duplicateChannel);
-    void SetBitDepth(TUint bitDepth);
-protected:
-    void Append(const TByte* aData, TUint aBytes);
-
-    virtual void ProcessFragment8(const Brx& aData, TUint aNumChannels) = 0;
-    virtual void ProcessFragment16(const Brx& aData, TUint aNumChannels) = 0;
-    virtual void ProcessFragment24(const Brx& aData, TUint aNumChannels) = 0;
-    virtual void ProcessFragment32(const Brx& aData, TUint aNumChannels) = 0;
-protected:
-    IDataSink& iSink;
-    Bwx&       iBuffer;
-    TBool      iDuplicateChannel;
-    TUint      iBitDepth;
+    ConversionArena();
+    void   Reserve(TUint aBytes);
+    TByte* Acquire(TUint aBytes);
+    TByte* Ptr() const;
+    TUint  Bytes() const;
+    TUint  RenderAllocations() const;
+private:
+    Bwh                iBuffer;
+    std::atomic<TUint> iBytes;
+    std::atomic<TUint> iRenderAllocations;
 };
 
-PcmProcessorBase::PcmProcessorBase(IDataSink& aDataSink, Bwx& aBuffer)
-: iSink(aDataSink)
-, iBuffer(aBuffer)
-, iDuplicateChannel(false)
-, iBitDepth(0)
-{
-}
-
-void PcmProcessorBase::SetDuplicateChannel(TBool duplicateChannel)
+ConversionArena::ConversionArena()
+: iBytes(0)
+, iRenderAllocations(0)
 {
-    iDuplicateChannel = duplicateChannel;
 }
 
-void PcmProcessorBase::SetBitDepth(TUint bitDepth)
+void ConversionArena::Reserve(TUint aBytes)
 {
-    iBitDepth = bitDepth;
-}
+    iBytes = aBytes;
 
-void PcmProcessorBase::Append(const TByte* aData, TUint aBytes)
-{
-    if (iBuffer.BytesRemaining() < aBytes)
-        Flush();
+    if (aBytes > iBuffer.MaxBytes())
+    {
+        iBuffer.Grow(aBytes);
 
-    iBuffer.Append(aData, aBytes);
+        // Fault the pages in now rather than on the first period.
+        memset((void *)iBuffer.Ptr(), 0, iBuffer.MaxBytes());
+    }
 }
 
-void PcmProcessorBase::Flush()
+TByte* ConversionArena::Acquire(TUint aBytes)
 {
-    if (iBuffer.Bytes() != 0)
+    if (aBytes > iBuffer.MaxBytes())
     {
-        iSink.Write(iBuffer);
-        iBuffer.SetBytes(0);
+        // Reserve() underestimated. Correct this, but flag it as a
+        // render path allocation.
+        iBuffer.Grow(aBytes);
+        iBytes = aBytes;
+        iRenderAllocations++;
     }
-}
 
-void PcmProcessorBase::BeginBlock()
-{
-    ASSERT(iBuffer.Bytes() == 0);
+    return (TByte *)iBuffer.Ptr();
 }
 
-void PcmProcessorBase::EndBlock()
+TByte* ConversionArena::Ptr() const
 {
-    Flush();
+    return (TByte *)iBuffer.Ptr();
 }
 
-void PcmProcessorBase::ProcessSilence(const Brx& aData, 
-                                      TUint aNumChannels,
-                                      TUint aNumSampleBytes)
+TUint ConversionArena::Bytes() const
 {
-    ProcessFragment(aData, aNumChannels, aNumSampleBytes);
+    return iBytes;
 }
 
-void PcmProcessorBase::ProcessFragment(const Brx& aData,
-                                       TUint aNumChannels,
-                                       TUint /*aNumSampleBytes*/)
+TUint ConversionArena::RenderAllocations() const
 {
-    switch (iBitDepth)
-    {
-        case 8: {
-            ProcessFragment8(aData, aNumChannels);
-            break;
-        }
-        case 16: {
-            ProcessFragment16(aData, aNumChannels);
-            break;
-        }
-        case 24: {
-            ProcessFragment24(aData, aNumChannels);
-            break;
-        }
-        case 32: {
-            ProcessFragment32(aData, aNumChannels);
-            break;
-        }
-        default: {
-            ASSERT_VA(false, "%s", "Unknown bit depth.");
-            break; // NOT REACHED
-        }
-    }
-
+    return iRenderAllocations;
 }
 
+typedef std::pair<snd_pcm_format_t, TUint> OutputFormat;
 
-// PcmProcessorLe
-
-class PcmProcessorLe : public PcmProcessorBase
+// DeviceCaps
+//
+// What the opened device accepts. It is probed once, when the device is
+// opened, so that choosing an output format at the start of a stream and
+// answering delay queries during playback don't have to go back to the
+// driver.
+//
+// If probing fails nothing is ruled out, and snd_pcm_set_params() has the
+// final say as before.
+
+class DeviceCaps
 {
 public:
-    PcmProcessorLe(IDataSink& aSink, Bwx& aBuffer);
-public: // IPcmProcessor
-    virtual void ProcessFragment8(const Brx& aData, TUint aNumChannels);
-    virtual void ProcessFragment16(const Brx& aData, TUint aNumChannels);
-    virtual void ProcessFragment24(const Brx& aData, TUint aNumChannels);
-    virtual void ProcessFragment32(const Brx& aData, TUint aNumChannels);
+    DeviceCaps();
+    void  Probe(snd_pcm_t* aHandle);
+    TBool SupportsFormat(snd_pcm_format_t aFormat) const;
+    TBool SupportsRate(TUint aSampleRate) const;
+    TUint NearestRate(TUint aSampleRate) const;
+    TBool SupportsChannels(TUint aNumChannels) const;
+    TBool SupportsMmap() const;
+    TUint MaxBitDepth() const;
+    TUint MaxRate() const;
+    snd_pcm_uframes_t ClampBuffer(snd_pcm_uframes_t aFrames) const;
+    snd_pcm_uframes_t ClampPeriod(snd_pcm_uframes_t aFrames) const;
+    void  Dump() const;
+private:
+    static const TUint kRates[];
+    static const TUint kRateCount;
+private:
+    TBool             iValid;
+    TBool             iFormats[kPcmFormatCount];
+    TBool             iMmap;
+    TUint             iRates;   // bit n set if kRates[n] is supported
+    TUint             iRateMin;
+    TUint             iRateMax;
+    TUint             iChannelsMin;
+    TUint             iChannelsMax;
+    snd_pcm_uframes_t iBufferMin;
+    snd_pcm_uframes_t iBufferMax;
+    snd_pcm_uframes_t iPeriodMin;
+    snd_pcm_uframes_t iPeriodMax;
+};
+
+const TUint DeviceCaps::kRates[] =
+{
+    8000, 11025, 16000, 22050, 32000, 44100, 48000, 88200, 96000,
+    176400, 192000, 352800, 384000, 705600, 768000
 };
 
-PcmProcessorLe::PcmProcessorLe(IDataSink& aSink, Bwx& aBuffer)
-: PcmProcessorBase(aSink, aBuffer)
+const TUint DeviceCaps::kRateCount = sizeof(kRates) / sizeof(kRates[0]);
+
+DeviceCaps::DeviceCaps()
+: iValid(false)
+, iFormats()
+, iMmap(false)
+, iRates(0)
+, iRateMin(0)
+, iRateMax(0)
+, iChannelsMin(0)
+, iChannelsMax(0)
+, iBufferMin(0)
+, iBufferMax(0)
+, iPeriodMin(0)
+, iPeriodMax(0)
 {
 }
 
-void PcmProcessorLe::ProcessFragment8(const Brx& aData, TUint aNumChannels)
+void DeviceCaps::Probe(snd_pcm_t* aHandle)
 {
-    TByte *nData;
-    TUint  bytes;
+    snd_pcm_hw_params_t *hwParams;
+    int                  dir;
 
-    // The input data is converted from unsigned 8 bit to signed 16 bit.
-    // to removes poor audio quality and glitches when part of a playlist
-    // with tracks of a different bit depth.
-    //
-    // Accordingly the amount of data is doubled.
-    bytes = aData.Bytes() * 2;
+    *this = DeviceCaps();
 
-    // If we are manually converting mono to stereo the data will double.
-    if (iDuplicateChannel)
+    snd_pcm_hw_params_alloca(&hwParams);
+    auto err = snd_pcm_hw_params_any(aHandle, hwParams);
+    if (err < 0)
     {
-        bytes *= 2;
+        Log::Print("DriverAlsa: Cannot get hardware parameters: %s\n",
+                   snd_strerror(err));
+        return;
     }
 
-    nData = new TByte[bytes];
-    ASSERT(nData != NULL);
+    for (TUint i = 0; i < kPcmFormatCount; i++)
+    {
+        iFormats[i] =
+            (snd_pcm_hw_params_test_format(aHandle, hwParams,
+                                           kPcmFormats[i]) == 0);
+    }
 
-    TByte *ptr  = (TByte *)(aData.Ptr() + 0);
-    TByte *ptr1 = (TByte *)nData;
-    TByte *endp = ptr1 + bytes;
+    iMmap = (snd_pcm_hw_params_test_access(aHandle, hwParams,
+                                           SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0);
 
-    while (ptr1 < endp)
+    for (TUint i = 0; i < kRateCount; i++)
     {
-        // Convert U8 to S16 data in little endian format.
-        *ptr1++ = 0x00;
-        *ptr1++ = *ptr - 0x80;
-
-        if (iDuplicateChannel)
+        if (snd_pcm_hw_params_test_rate(aHandle, hwParams, kRates[i], 0) == 0)
         {
-            *ptr1++ = 0x00;
-            *ptr1++ = *ptr - 0x80;
+            iRates |= 1 << i;
         }
-
-        ptr++;
     }
 
-    Brn fragment(nData, bytes);
-    Flush();
-    iSink.Write(fragment);
-    delete[] nData;
+    snd_pcm_hw_params_get_rate_min(hwParams, &iRateMin, &dir);
+    snd_pcm_hw_params_get_rate_max(hwParams, &iRateMax, &dir);
+    snd_pcm_hw_params_get_channels_min(hwParams, &iChannelsMin);
+    snd_pcm_hw_params_get_channels_max(hwParams, &iChannelsMax);
+    snd_pcm_hw_params_get_buffer_size_min(hwParams, &iBufferMin);
+    snd_pcm_hw_params_get_buffer_size_max(hwParams, &iBufferMax);
+    snd_pcm_hw_params_get_period_size_min(hwParams, &iPeriodMin, &dir);
+    snd_pcm_hw_params_get_period_size_max(hwParams, &iPeriodMax, &dir);
+
+    iValid = true;
 }
 
-void PcmProcessorLe::ProcessFragment16(const Brx& aData, TUint aNumChannels)
+TBool DeviceCaps::SupportsFormat(snd_pcm_format_t aFormat) const
 {
-    TByte *nData;
-    TUint  bytes;
-
-    bytes = aData.Bytes();
+    const TUint index = PcmFormatIndex(aFormat);
+    return !iValid || (index != kPcmFormatCount && iFormats[index]);
+}
 
-    // If we are manually converting mono to stereo the data will double.
-    if (iDuplicateChannel)
+TBool DeviceCaps::SupportsRate(TUint aSampleRate) const
+{
+    if (!iValid)
     {
-        bytes *= 2;
+        return true;
     }
 
-    nData = new TByte[bytes];
-    ASSERT(nData != NULL);
+    for (TUint i = 0; i < kRateCount; i++)
+    {
+        if (kRates[i] == aSampleRate)
+        {
+            return (iRates & (1 << i)) != 0;
+        }
+    }
 
-    TByte *ptr  = (TByte *)(aData.Ptr() + 0);
-    TByte *ptr1 = (TByte *)nData;
-    TByte *endp = ptr1 + bytes;
+    // Not a rate we probed for. The range is the best we know.
+    return aSampleRate >= iRateMin && aSampleRate <= iRateMax;
+}
 
-    ASSERT(bytes % 2 == 0);
+TUint DeviceCaps::NearestRate(TUint aSampleRate) const
+{
+    // The lowest rate that loses none of the stream's bandwidth, failing
+    // that the highest the device has.
+    TUint nearest = 0;
 
-    while (ptr1 < endp)
+    for (TUint i = 0; iValid && i < kRateCount; i++)
     {
-        // Store the S16 data in little endian format.
-        *ptr1++ = *(ptr+1);
-        *ptr1++ = *(ptr);
+        if ((iRates & (1 << i)) == 0)
+        {
+            continue;
+        }
 
-        if (iDuplicateChannel)
+        nearest = kRates[i];
+
+        if (kRates[i] >= aSampleRate)
         {
-            *ptr1++ = *(ptr+1);
-            *ptr1++ = *(ptr);
+            break;
         }
+    }
+
+    return nearest;
+}
+
+TBool DeviceCaps::SupportsChannels(TUint aNumChannels) const
+{
+    return !iValid ||
+           (aNumChannels >= iChannelsMin && aNumChannels <= iChannelsMax);
+}
+
+TBool DeviceCaps::SupportsMmap() const
+{
+    return !iValid || iMmap;
+}
+
+TUint DeviceCaps::MaxBitDepth() const
+{
+    TUint maxBitDepth = 0;
+
+    // The deepest format the device takes that we can also convert to.
+    for (TUint i = 0; i < kPcmFormatCount; i++)
+    {
+        if (iFormats[i])
+        {
+            const TUint width = snd_pcm_format_width(kPcmFormats[i]);
 
-        ptr +=2;
+            if (width > maxBitDepth)
+            {
+                maxBitDepth = width;
+            }
+        }
     }
 
-    Brn fragment(nData, bytes);
-    Flush();
-    iSink.Write(fragment);
-    delete[] nData;
+    return maxBitDepth;
 }
 
-void PcmProcessorLe::ProcessFragment24(const Brx& aData, TUint aNumChannels)
+TUint DeviceCaps::MaxRate() const
 {
-    TByte *nData;
-    TUint  bytes;
+    // The highest standard rate the device takes. The range reported by
+    // plug devices reaches far beyond anything worth playing.
+    TUint maxRate = 0;
 
-    // 24 bit audio is not supported on the platform so it is converted
-    // to signed 16 bit audio for playback.
-    //
-    // Accordingly one third of the input data is discarded.
-    bytes = (aData.Bytes() * 2) / 3;
+    for (TUint i = 0; iValid && i < kRateCount; i++)
+    {
+        if (iRates & (1 << i))
+        {
+            maxRate = kRates[i];
+        }
+    }
 
-    // If we are manually converting mono to stereo the data will double.
-    if (iDuplicateChannel)
+    return maxRate;
+}
+
+snd_pcm_uframes_t DeviceCaps::ClampBuffer(snd_pcm_uframes_t aFrames) const
+{
+    if (iValid)
     {
-        bytes *= 2;
+        aFrames = std::max(aFrames, iBufferMin);
+        aFrames = std::min(aFrames, iBufferMax);
     }
 
-    nData = new TByte[bytes];
-    ASSERT(nData != NULL);
+    return aFrames;
+}
 
-    TByte *ptr  = (TByte *)(aData.Ptr() + 0);
-    TByte *ptr1 = (TByte *)nData;
-    TByte *endp = ptr1 + bytes;
+snd_pcm_uframes_t DeviceCaps::ClampPeriod(snd_pcm_uframes_t aFrames) const
+{
+    if (iValid)
+    {
+        aFrames = std::max(aFrames, iPeriodMin);
+        aFrames = std::min(aFrames, iPeriodMax);
+    }
 
-    ASSERT(bytes % 2 == 0);
+    return aFrames;
+}
 
-    while (ptr1 < endp)
+void DeviceCaps::Dump() const
+{
+    if (!iValid)
     {
-        // Store the data in little endian format.
-        *ptr1++ = *(ptr+1);
-        *ptr1++ = *(ptr+0);
+        Log::Print("DriverAlsa: Device capabilities unknown\n");
+        return;
+    }
 
-        if (iDuplicateChannel)
+    Log::Print("DriverAlsa: Device formats:");
+    for (TUint i = 0; i < kPcmFormatCount; i++)
+    {
+        if (iFormats[i])
         {
-            *ptr1++ = *(ptr+1);
-            *ptr1++ = *(ptr+0);
+            Log::Print(" %s", snd_pcm_format_name(kPcmFormats[i]));
         }
+    }
+    Log::Print("\n");
 
-        ptr += 3;
+    Log::Print("DriverAlsa: Device rates:");
+    for (TUint i = 0; i < kRateCount; i++)
+    {
+        if (iRates & (1 << i))
+        {
+            Log::Print(" %u", kRates[i]);
+        }
     }
+    Log::Print(" (range %u - %u)\n", iRateMin, iRateMax);
 
-    Brn fragment(nData, bytes);
-    Flush();
-    iSink.Write(fragment);
-    delete[] nData;
+    Log::Print("DriverAlsa: Device channels %u - %u, "
+               "buffer %lu - %lu frames, period %lu - %lu frames, mmap %s\n",
+               iChannelsMin, iChannelsMax, iBufferMin, iBufferMax,
+               iPeriodMin, iPeriodMax, iMmap ? "yes" : "no");
 }
 
-void PcmProcessorLe::ProcessFragment32(const Brx& aData, TUint aNumChannels)
+
+// PcmProcessorAlsa
+//
+// Converts pipeline PCM into the ALSA format chosen for the stream.
+//
+// The converters for every subsample width the pipeline can deliver are
+// looked up once, in Configure(), so rendering a fragment is a single call
+// through a table of compile time specialised kernels.
+//
+// Streams at a rate the device can't play first go through a
+// PolyphaseResampler, and while a clock puller is steering playback audio
+// goes through an AdaptiveResampler. Either way the audio is resampled as
+// 32 bit samples, then goes through the 32 bit converter.
+
+class PcmProcessorAlsa : public IPcmProcessor
 {
-    TByte *nData;
-    TUint  bytes;
+    static const TUint kMaxChannels = AdaptiveResampler::kMaxChannels;
+    static const TUint kBlockFrames = 256;
+    // The adaptive resampler writes at most one frame more than it reads
+    // at the rates it is given, the rest is headroom.
+    static const TUint kAdjustOutFrames = kBlockFrames + 8;
+    // Of a 16 bit full scale, about -60 dBFS.
+    static const TInt kQuietLevel = 32;
+public:
+    PcmProcessorAlsa(IDataSink& aDataSink);
+    void  Configure(OutputFormat aFormat, TBool aDuplicateChannel);
+    void  PrepareResample(TUint aInRate, TUint aOutRate,
+                          ResamplerQuality aQuality);
+    TBool EnableResample(TUint aInRate, TUint aOutRate, TUint aNumChannels,
+                         ResamplerQuality aQuality);
+    void  DisableResample();
+    TUint ResampleDelayFrames() const;
+    TUint RateAdjustDelayFrames() const;
+    void  EnableRateAdjust(TUint aNumChannels);
+    void  DisableRateAdjust();
+    void  SetRatePpb(TInt aPpb);
+    TBool Quiet() const;
+public: // IPcmProcessor
+    void BeginBlock() override;
+    void ProcessFragment(const Brx& aData, TUint aNumChannels, TUint aSubsampleBytes) override;
+    void ProcessSilence(const Brx& aData, TUint aNumChannels, TUint aSubsampleBytes) override;
+    void EndBlock() override;
+    void Flush() override;
+private:
+    static TBool QuietFrame(const Brx& aData, TUint aNumChannels,
+                            TUint aSubsampleBytes);
+    void Convert(PcmKernel aConverter, const TByte* aSrc, TUint aSubsamples,
+                 TUint aSrcBytes, TUint aOutBytes);
+    void ProcessResampled(const Brx& aData, TUint aNumChannels,
+                          TUint aSubsampleBytes);
+    void Adjust(const TInt32* aFrames, TUint aCount, TUint aNumChannels,
+                PcmKernel aConverter, TUint aOutBytes);
+    void Output(const TInt32* aSamples, TUint aCount, PcmKernel aConverter,
+                TUint aOutBytes);
+private:
+    IDataSink&         iSink;
+    TUint              iOutputBytes;
+    TBool              iDuplicateChannel;
+    PcmKernel          iConverters[kPcmMaxSourceBytes][ePcmChannelMapCount];
+    TBool              iResample;
+    PolyphaseResampler iPolyphase;
+    TBool              iRateAdjust;
+    AdaptiveResampler  iResampler;
+    TBool              iQuiet;      // the last frame was near silent
+    TInt32             iDecoded[kBlockFrames * kMaxChannels];
+    TInt32             iResampled[kBlockFrames * kMaxChannels];
+    TInt32             iAdjusted[kAdjustOutFrames * kMaxChannels];
+    TByte              iEncoded[kAdjustOutFrames * kMaxChannels * 4];
+};
 
-    // Currently the only 32 bit pcm in the pipeline is auto-generated by
-    // the ramper.
-    //
-    // This may differ from the stream format so we must do the conversion
-    // here.
-    bytes = aData.Bytes();
+const TUint PcmProcessorAlsa::kBlockFrames;
+const TInt  PcmProcessorAlsa::kQuietLevel;
+const TUint PcmProcessorAlsa::kAdjustOutFrames;
 
-    // If we are manually converting mono to stereo the data will double.
-    //
-    // aNumChannels must be checked as the ramper can inject 32 bit
-    // stereo into the pipeline.
-    if (iDuplicateChannel && (aNumChannels != 2))
+PcmProcessorAlsa::PcmProcessorAlsa(IDataSink& aDataSink)
+: iSink(aDataSink)
+, iOutputBytes(0)
+, iDuplicateChannel(false)
+, iConverters()
+, iResample(false)
+, iRateAdjust(false)
+, iQuiet(true)
+{
+}
+
+void PcmProcessorAlsa::PrepareResample(TUint aInRate, TUint aOutRate,
+                                       ResamplerQuality aQuality)
+{
+    // EnableResample() with the same rates will find the filter ready.
+    iResample = false;
+    iPolyphase.Configure(aInRate, aOutRate, aQuality);
+}
+
+TBool PcmProcessorAlsa::EnableResample(TUint aInRate, TUint aOutRate,
+                                       TUint aNumChannels,
+                                       ResamplerQuality aQuality)
+{
+    iResample = iPolyphase.Configure(aInRate, aOutRate, aQuality);
+
+    if (iResample)
     {
-        bytes *= 2;
+        iPolyphase.Reset(aNumChannels);
     }
 
-    nData = new TByte[bytes];
-    ASSERT(nData != NULL);
+    return iResample;
+}
+
+void PcmProcessorAlsa::DisableResample()
+{
+    iResample = false;
+}
 
-    TByte *ptr  = (TByte *)(aData.Ptr() + 0);
-    TByte *endp = ptr + aData.Bytes();
-    TByte *ptr1 = (TByte *)nData;
+TUint PcmProcessorAlsa::ResampleDelayFrames() const
+{
+    return iResample ? iPolyphase.DelayFrames() : 0;
+}
 
-    TUint outBytes = 0;
+TUint PcmProcessorAlsa::RateAdjustDelayFrames() const
+{
+    return iRateAdjust ? iResampler.DelayFrames() : 0;
+}
 
-    while (ptr < endp)
+void PcmProcessorAlsa::EnableRateAdjust(TUint aNumChannels)
+{
+    // Gapless streams carry on through the same history, so only a fresh
+    // start, or a different number of channels, begins it again.
+    if (!iRateAdjust || aNumChannels != iResampler.Channels())
     {
-        switch (iBitDepth)
-        {
-            // The system only supports upto 16 bit.
-            //
-            // Convert everything above that to 16 bit.
-            case 32:
-            // Fallthrough
-            case 24:
-            // Fallthrough
-            case 16:
-            {
-                // Store the data in little endian format.
-                *ptr1++ = *(ptr+1);
-                *ptr1++ = *(ptr+0);
-                outBytes += 2;
+        iResampler.Reset(aNumChannels);
+    }
 
-                if (iDuplicateChannel && (aNumChannels != 2))
-                {
-                    *ptr1++ = *(ptr+1);
-                    *ptr1++ = *(ptr+0);
-                    outBytes += 2;
-                }
+    iRateAdjust = true;
+}
 
-                break;
-            }
-            // The platform is configured for 8 bit. Convert.
-            case 8:
-            {
-                *ptr1++ = *(ptr+0);
-                outBytes += 1;
+void PcmProcessorAlsa::DisableRateAdjust()
+{
+    iRateAdjust = false;
+}
 
-                if (iDuplicateChannel && (aNumChannels != 2))
-                {
-                    *ptr1++ = *(ptr+0);
-                    outBytes += 1;
-                }
+void PcmProcessorAlsa::SetRatePpb(TInt aPpb)
+{
+    iResampler.SetRatePpb(aPpb);
+}
 
-                break;
-            }
-        }
+TBool PcmProcessorAlsa::Quiet() const
+{
+    return iQuiet;
+}
+
+void PcmProcessorAlsa::Configure(OutputFormat aFormat, TBool aDuplicateChannel)
+{
+    const PcmKernels& kernels = PcmKernels::Instance();
+
+    iOutputBytes      = aFormat.second;
+    iDuplicateChannel = aDuplicateChannel;
 
-        ptr += 4;
+    // The ramper can inject 32 bit audio into streams of any bit depth, so
+    // a converter is needed for each source width, not just the stream's.
+    for (TUint i = 0; i < kPcmMaxSourceBytes; i++)
+    {
+        iConverters[i][ePcmInterleaved] =
+            kernels.Kernel(i + 1, aFormat.first, ePcmInterleaved);
+        iConverters[i][ePcmMonoToStereo] =
+            kernels.Kernel(i + 1, aFormat.first, ePcmMonoToStereo);
     }
+}
 
-    Brn fragment(nData, outBytes);
-    Flush();
-    iSink.Write(fragment);
-    delete[] nData;
+void PcmProcessorAlsa::Flush()
+{
 }
 
-// PcmProcessorLe32
+void PcmProcessorAlsa::BeginBlock()
+{
+}
 
-class PcmProcessorLe32 : public PcmProcessorLe
+void PcmProcessorAlsa::EndBlock()
 {
-public:
-    PcmProcessorLe32(IDataSink& aSink, Bwx& aBuffer);
-public: // IPcmProcessor
-    void ProcessFragment24(const Brx& aData, TUint aNumChannels);
-    void ProcessFragment32(const Brx& aData, TUint aNumChannels);
-};
+}
 
-PcmProcessorLe32::PcmProcessorLe32(IDataSink& aSink, Bwx& aBuffer)
-: PcmProcessorLe(aSink, aBuffer)
+void PcmProcessorAlsa::ProcessSilence(const Brx& aData,
+                                      TUint aNumChannels,
+                                      TUint aSubsampleBytes)
 {
+    ProcessFragment(aData, aNumChannels, aSubsampleBytes);
 }
 
-void PcmProcessorLe32::ProcessFragment24(const Brx& aData, TUint aNumChannels)
+void PcmProcessorAlsa::ProcessFragment(const Brx& aData,
+                                       TUint aNumChannels,
+                                       TUint aSubsampleBytes)
 {
-    TByte *nData;
-    TUint  bytes;
+    ASSERT(aSubsampleBytes >= 1 && aSubsampleBytes <= kPcmMaxSourceBytes);
 
-    // 24 bit audio is not supported on the platform so it is converted
-    // to signed 32 bit audio for playback.
-    //
-    // Accordingly we allocate room for 4 byte samples.
-    bytes = (aData.Bytes() * 4) / 3;
+    iQuiet = QuietFrame(aData, aNumChannels, aSubsampleBytes);
 
-    // If we are manually converting mono to stereo the data will double.
-    if (iDuplicateChannel)
+    if (iResample || iRateAdjust)
     {
-        bytes *= 2;
+        ProcessResampled(aData, aNumChannels, aSubsampleBytes);
+        return;
     }
 
-    nData = new TByte[bytes];
-    ASSERT(nData != NULL);
+    // If we are manually converting mono to stereo the data will double.
+    //
+    // aNumChannels must be checked as the ramper can inject 32 bit
+    // stereo into the pipeline.
+    const PcmChannelMap map = (iDuplicateChannel && aNumChannels == 1) ?
+                                  ePcmMonoToStereo : ePcmInterleaved;
+    const PcmKernel converter = iConverters[aSubsampleBytes - 1][map];
+    ASSERT(converter != nullptr);
+
+    // Output bytes per source subsample.
+    const TUint outBytes =
+        (map == ePcmMonoToStereo) ? iOutputBytes * 2 : iOutputBytes;
+
+    Convert(converter, aData.Ptr(), aData.Bytes() / aSubsampleBytes,
+            aSubsampleBytes, outBytes);
+}
+
+TBool PcmProcessorAlsa::QuietFrame(const Brx& aData, TUint aNumChannels,
+                                   TUint aSubsampleBytes)
+{
+    const TUint frameBytes = aNumChannels * aSubsampleBytes;
 
-    TByte *ptr  = (TByte *)(aData.Ptr() + 0);
-    TByte *ptr1 = (TByte *)nData;
-    TByte *endp = ptr1 + bytes;
+    if (aData.Bytes() < frameBytes)
+    {
+        return true;
+    }
 
-    ASSERT(bytes % 4 == 0);
+    // Big endian, so the top two bytes of each subsample are enough.
+    const TByte* p = aData.Ptr() + aData.Bytes() - frameBytes;
 
-    while (ptr1 < endp)
+    for (TUint i = 0; i < aNumChannels; i++, p += aSubsampleBytes)
     {
-        // Store the data in little endian format.
-        *ptr1++ = 0;
-        *ptr1++ = *(ptr+2);
-        *ptr1++ = *(ptr+1);
-        *ptr1++ = *(ptr+0);
+        TInt level = (TInt)(signed char)p[0] * 256;
 
-        if (iDuplicateChannel)
+        if (aSubsampleBytes > 1)
         {
-            *ptr1++ = 0;
-            *ptr1++ = *(ptr+2);
-            *ptr1++ = *(ptr+1);
-            *ptr1++ = *(ptr+0);
+            level += p[1];
         }
 
-        ptr += 3;
+        if (level > kQuietLevel || level < -kQuietLevel)
+        {
+            return false;
+        }
     }
 
-    Brn fragment(nData, bytes);
-    Flush();
-    iSink.Write(fragment);
-    delete[] nData;
+    return true;
 }
 
-void PcmProcessorLe32::ProcessFragment32(const Brx& aData, TUint aNumChannels)
+void PcmProcessorAlsa::Convert(PcmKernel aConverter, const TByte* aSrc,
+                               TUint aSubsamples, TUint aSrcBytes,
+                               TUint aOutBytes)
 {
-    TByte *nData;
-    TUint  bytes;
+    // The sink may hand out less space than asked for, at the end of the
+    // mmap area for example, so convert in as many pieces as it needs.
+    while (aSubsamples > 0)
+    {
+        TUint  bytes = aSubsamples * aOutBytes;
+        TByte* dst   = iSink.Acquire(bytes);
 
-    // Currently the only 32 bit pcm in the pipeline is auto-generated by
-    // the ramper.
-    //
-    // This may differ from the stream format so we must do the conversion
-    // here.
-    bytes = aData.Bytes();
+        if (dst == nullptr)
+        {
+            break;
+        }
 
-    // If we are manually converting mono to stereo the data will double.
-    //
-    // aNumChannels must be checked as the ramper can inject 32 bit
-    // stereo into the pipeline.
-    if (iDuplicateChannel && (aNumChannels != 2))
+        const TUint count = bytes / aOutBytes;
+
+        aConverter(aSrc, dst, count);
+        iSink.Commit(count * aOutBytes);
+
+        aSrc        += count * aSrcBytes;
+        aSubsamples -= count;
+    }
+}
+
+void PcmProcessorAlsa::ProcessResampled(const Brx& aData, TUint aNumChannels,
+                                        TUint aSubsampleBytes)
+{
+    // The ramper's 32 bit stereo into a mono stream, say.
+    if (iResample && aNumChannels != iPolyphase.Channels())
+    {
+        iPolyphase.Reset(aNumChannels);
+    }
+
+    if (iRateAdjust && aNumChannels != iResampler.Channels())
     {
-        bytes *= 2;
+        iResampler.Reset(aNumChannels);
     }
 
-    nData = new TByte[bytes];
-    ASSERT(nData != NULL);
+    const PcmChannelMap map = (iDuplicateChannel && aNumChannels == 1) ?
+                                  ePcmMonoToStereo : ePcmInterleaved;
+    const PcmKernel converter = iConverters[3][map];
+    ASSERT(converter != nullptr);
 
-    TByte *ptr  = (TByte *)(aData.Ptr() + 0);
-    TByte *endp = ptr + aData.Bytes();
-    TByte *ptr1 = (TByte *)nData;
+    const TUint outBytes =
+        (map == ePcmMonoToStereo) ? iOutputBytes * 2 : iOutputBytes;
 
-    TUint outBytes = 0;
+    // Pipeline audio is big endian and left justified into 32 bits here.
+    // Unsigned 8 bit is the one width that needs its sign flipping.
+    const TUint32 flip = (aSubsampleBytes == 1) ? 0x80000000 : 0;
 
-    while (ptr < endp)
+    const TByte* src    = aData.Ptr();
+    TUint        frames = aData.Bytes() / (aSubsampleBytes * aNumChannels);
+
+    while (frames > 0)
     {
-        switch (iBitDepth)
+        TUint inFrames = std::min(frames, kBlockFrames);
+
+        for (TUint i = 0; i < inFrames * aNumChannels; i++)
         {
-            // The platform supports and is configured for 32 bit audio.
-            case 32:
-            // Fallthrough
-            case 24:
+            TUint32 v = 0;
+
+            for (TUint b = 0; b < aSubsampleBytes; b++)
             {
-                *ptr1++ = *(ptr+3);
-                *ptr1++ = *(ptr+2);
-                *ptr1++ = *(ptr+1);
-                *ptr1++ = *(ptr+0);
-                outBytes += 4;
+                v |= (TUint32)*src++ << (24 - 8 * b);
+            }
 
-                if (iDuplicateChannel && (aNumChannels != 2))
-                {
-                    *ptr1++ = *(ptr+3);
-                    *ptr1++ = *(ptr+2);
-                    *ptr1++ = *(ptr+1);
-                    *ptr1++ = *(ptr+0);
-                    outBytes += 4;
-                }
+            iDecoded[i] = (TInt32)(v ^ flip);
+        }
 
-                break;
-            }
-            // The platform is configured for 16 bit. Convert.
-            case 16:
-            {
-                *ptr1++ = *(ptr+1);
-                *ptr1++ = *(ptr+0);
-                outBytes += 2;
+        frames -= inFrames;
 
-                if (iDuplicateChannel && (aNumChannels != 2))
-                {
-                    *ptr1++ = *(ptr+1);
-                    *ptr1++ = *(ptr+0);
-                    outBytes += 2;
-                }
+        if (!iResample)
+        {
+            Adjust(iDecoded, inFrames, aNumChannels, converter, outBytes);
+            continue;
+        }
 
-                break;
-            }
-            // The platform is configured for 8 bit. Convert.
-            case 8:
-            {
-                *ptr1++ = *(ptr+1);
-                *ptr1++ = *(ptr+0);
-                outBytes += 2;
+        const TInt32* in = iDecoded;
 
-                if (iDuplicateChannel && (aNumChannels != 2))
-                {
-                    *ptr1++ = *(ptr+1);
-                    *ptr1++ = *(ptr+0);
-                    outBytes += 2;
-                }
+        // Upsampling writes more than it reads, so go round until the
+        // whole block has been taken and nothing more comes out.
+        for (;;)
+        {
+            TUint       consumed = inFrames;
+            const TUint written  = iPolyphase.Process(in, consumed,
+                                                      iResampled,
+                                                      kBlockFrames);
+
+            Adjust(iResampled, written, aNumChannels, converter, outBytes);
 
+            in       += consumed * aNumChannels;
+            inFrames -= consumed;
+
+            if (inFrames == 0 && written < kBlockFrames)
+            {
                 break;
             }
         }
+    }
+}
 
-        ptr += 4;
+void PcmProcessorAlsa::Adjust(const TInt32* aFrames, TUint aCount,
+                              TUint aNumChannels, PcmKernel aConverter,
+                              TUint aOutBytes)
+{
+    if (!iRateAdjust)
+    {
+        Output(aFrames, aCount * aNumChannels, aConverter, aOutBytes);
+        return;
     }
 
-    Brn fragment(nData, outBytes);
-    Flush();
-    iSink.Write(fragment);
-    delete[] nData;
+    // The resampler stops when its output is full, so go round until it
+    // has taken everything.
+    while (aCount > 0)
+    {
+        TUint       consumed = aCount;
+        const TUint written  = iResampler.Process(aFrames, consumed,
+                                                  iAdjusted,
+                                                  kAdjustOutFrames);
+
+        Output(iAdjusted, written * aNumChannels, aConverter, aOutBytes);
+
+        aFrames += consumed * aNumChannels;
+        aCount  -= consumed;
+    }
 }
 
-typedef std::pair<snd_pcm_format_t, TUint> OutputFormat;
+void PcmProcessorAlsa::Output(const TInt32* aSamples, TUint aCount,
+                              PcmKernel aConverter, TUint aOutBytes)
+{
+    TByte* dst = iEncoded;
+
+    for (TUint i = 0; i < aCount; i++)
+    {
+        const TUint32 v = (TUint32)aSamples[i];
+
+        *dst++ = (TByte)(v >> 24);
+        *dst++ = (TByte)(v >> 16);
+        *dst++ = (TByte)(v >> 8);
+        *dst++ = (TByte)v;
+    }
+
+    Convert(aConverter, iEncoded, aCount, 4, aOutBytes);
+}
+
+// Profile
+//
+// The output formats to try for streams of one bit depth, best first.
+//
+// Formats that hold every bit of the source come first, narrowest first, so
+// that 24 bit audio reaches the DAC packed rather than widened to 32 bits.
+// Formats that truncate the source are a last resort.
 
 class Profile
 {
 public:
-    Profile(IPcmProcessor* aPcmProcessor, OutputFormat aFormat32,
-                                          OutputFormat aFormat24,
-                                          OutputFormat aFormat16,
-                                          OutputFormat aFormat8);
+    Profile(TUint aBitDepth, std::initializer_list<OutputFormat> aFormats);
 public:
-    OutputFormat   GetFormat(TUint aBitDepth) const;
-    IPcmProcessor& GetPcmProcessor() const;
+    TUint BitDepth() const;
+    const std::vector<OutputFormat>& Formats() const;
 private:
-    std::unique_ptr<IPcmProcessor> iPcmProcessor;
-    OutputFormat                   iOutputDesc[4];
+    TUint                     iBitDepth;
+    std::vector<OutputFormat> iFormats;
 };
 
-Profile::Profile(IPcmProcessor* aPcmProcessor, OutputFormat aFormat32,
-                                               OutputFormat aFormat24,
-                                               OutputFormat aFormat16,
-                                               OutputFormat aFormat8)
-: iPcmProcessor(aPcmProcessor)
+Profile::Profile(TUint aBitDepth, std::initializer_list<OutputFormat> aFormats)
+: iBitDepth(aBitDepth)
+, iFormats(aFormats)
 {
-    iOutputDesc[0] = aFormat32;
-    iOutputDesc[1] = aFormat24;
-    iOutputDesc[2] = aFormat16;
-    iOutputDesc[3] = aFormat8;
 }
 
-OutputFormat Profile::GetFormat(TUint aBitDepth) const
+TUint Profile::BitDepth() const
 {
-    switch (aBitDepth)
-    {
-        case 32:
-            return iOutputDesc[0];
-        case 24:
-            return iOutputDesc[1];
-        case 16:
-            return iOutputDesc[2];
-        case 8:
-            return iOutputDesc[3];
-        default:
-            ASSERTS();
-            return iOutputDesc[0];
+    return iBitDepth;
+}
+
+const std::vector<OutputFormat>& Profile::Formats() const
+{
+    return iFormats;
+}
+
+// StreamChangeStats
+//
+// How long the PipelineAnimator thread stays away from the device when a
+// new stream starts, which is the gap heard between tracks, and how often
+// the device actually had to be reconfigured.
+
+class StreamChangeStats
+{
+public:
+    StreamChangeStats();
+    void  Record(TBool aReconfigured, TUint aGapUs);
+    void  Reset();
+    TUint StreamChanges() const;
+    TUint Reconfigurations() const;
+    TUint LastGapUs() const;
+    TUint MaxGapUs() const;
+private:
+    std::atomic<TUint> iStreamChanges;
+    std::atomic<TUint> iReconfigurations;
+    std::atomic<TUint> iLastGapUs;
+    std::atomic<TUint> iMaxGapUs;
+};
+
+StreamChangeStats::StreamChangeStats()
+: iStreamChanges(0)
+, iReconfigurations(0)
+, iLastGapUs(0)
+, iMaxGapUs(0)
+{
+}
+
+void StreamChangeStats::Record(TBool aReconfigured, TUint aGapUs)
+{
+    iStreamChanges++;
+
+    if (aReconfigured)
+    {
+        iReconfigurations++;
+    }
+
+    iLastGapUs = aGapUs;
+
+    if (aGapUs > iMaxGapUs)
+    {
+        iMaxGapUs = aGapUs;
+    }
+}
+
+void StreamChangeStats::Reset()
+{
+    iStreamChanges    = 0;
+    iReconfigurations = 0;
+    iLastGapUs        = 0;
+    iMaxGapUs         = 0;
+}
+
+TUint StreamChangeStats::StreamChanges() const
+{
+    return iStreamChanges;
+}
+
+TUint StreamChangeStats::Reconfigurations() const
+{
+    return iReconfigurations;
+}
+
+TUint StreamChangeStats::LastGapUs() const
+{
+    return iLastGapUs;
+}
+
+TUint StreamChangeStats::MaxGapUs() const
+{
+    return iMaxGapUs;
+}
+
+// BufferTuner
+//
+// The hardware buffer time for a device. It starts at the target latency,
+// or wherever it was last left for the device, grows after an underrun and
+// creeps back towards the target while playback stays clean. The value is
+// kept in the store so a device that needs a deep buffer starts with one.
+// Each mode has its own target, and so its own value.
+//
+// Grow() and Shrink() only change the value in memory, as they may be
+// called mid stream. Save() writes it out, at a stream boundary or when
+// the device is closed.
+
+class BufferTuner
+{
+    static const TUint kMinUs        = 5000;
+    static const TUint kMaxUs        = 500000;
+    static const TUint kMaxValueBytes = 16;
+public:
+    BufferTuner(Configuration::IStoreReadWrite& aStore, TUint aTargetUs);
+    void  Load(const TChar* aDevice);
+    void  Select(const Brx& aMode, TUint aTargetUs);
+    TUint BufferUs() const;
+    TUint TargetUs() const;
+    TBool Grow();
+    TBool Shrink();
+    void  Save();
+private:
+    void  Restore();
+    void  Set(TUint aBufferUs);
+private:
+    Configuration::IStoreReadWrite& iStore;
+    TUint                           iTargetUs;
+    TUint                           iBufferUs;
+    TUint                           iSavedUs;
+    TUint                           iDeviceId;
+    Bws<32>                         iMode;
+    Bws<64>                         iKey;
+};
+
+const TUint BufferTuner::kMinUs;
+const TUint BufferTuner::kMaxUs;
+
+BufferTuner::BufferTuner(Configuration::IStoreReadWrite& aStore,
+                         TUint aTargetUs)
+: iStore(aStore)
+, iTargetUs(std::min(std::max(aTargetUs, kMinUs), kMaxUs))
+, iBufferUs(iTargetUs)
+, iSavedUs(iTargetUs)
+, iDeviceId(0)
+{
+}
+
+void BufferTuner::Load(const TChar* aDevice)
+{
+    Save();
+
+    // Device names hold characters the store can't have in a key.
+    iDeviceId = ConfigAlsaDevice::Id(aDevice);
+
+    Restore();
+}
+
+void BufferTuner::Select(const Brx& aMode, TUint aTargetUs)
+{
+    Save();
+
+    iMode.Replace(Brn(aMode.Ptr(), std::min(aMode.Bytes(), iMode.MaxBytes())));
+    iTargetUs = std::min(std::max(aTargetUs, kMinUs), kMaxUs);
+
+    Restore();
+}
+
+void BufferTuner::Restore()
+{
+    iKey.Replace(Brn("Alsa.BufferUs."));
+    iKey.AppendPrintf("%08x", iDeviceId);
+
+    if (iMode.Bytes() > 0)
+    {
+        iKey.Append('.');
+        iKey.Append(iMode);
+    }
+
+    iBufferUs = iTargetUs;
+
+    try
+    {
+        Bws<kMaxValueBytes> value;
+        iStore.Read(iKey, value);
+
+        const TUint stored = strtoul(value.PtrZ(), nullptr, 10);
+        iBufferUs = std::min(std::max(stored, iTargetUs), kMaxUs);
+    }
+    catch (StoreKeyNotFound&)
+    {
+    }
+    catch (StoreReadBufferUndersized&)
+    {
+    }
+
+    iSavedUs = iBufferUs;
+
+    Log::Print("DriverAlsa: Buffer %u us (target %u us)\n",
+               iBufferUs, iTargetUs);
+}
+
+TUint BufferTuner::BufferUs() const
+{
+    return iBufferUs;
+}
+
+TUint BufferTuner::TargetUs() const
+{
+    return iTargetUs;
+}
+
+TBool BufferTuner::Grow()
+{
+    const TUint bufferUs = std::min(iBufferUs + iBufferUs / 2, kMaxUs);
+
+    if (bufferUs == iBufferUs)
+    {
+        return false;
+    }
+
+    Set(bufferUs);
+    return true;
+}
+
+TBool BufferTuner::Shrink()
+{
+    const TUint bufferUs = std::max(iBufferUs - iBufferUs / 10, iTargetUs);
+
+    if (bufferUs == iBufferUs)
+    {
+        return false;
+    }
+
+    Set(bufferUs);
+    return true;
+}
+
+void BufferTuner::Set(TUint aBufferUs)
+{
+    Log::Print("DriverAlsa: Buffer %u us -> %u us\n", iBufferUs, aBufferUs);
+
+    iBufferUs = aBufferUs;
+}
+
+void BufferTuner::Save()
+{
+    if (iBufferUs == iSavedUs)
+    {
+        return;
+    }
+
+    Bws<kMaxValueBytes> value;
+    value.AppendPrintf("%u", iBufferUs);
+    iStore.Write(iKey, value);
+
+    iSavedUs = iBufferUs;
+}
+
+// ModeLatency
+//
+// The hardware buffer and ring depth for each pipeline mode. Local files
+// and network streams keep the driver's own target, which the buffer tuner
+// already deepens for a device that underruns. A Songcast receiver has to
+// keep in step with the sender and the other rooms, so holds less below
+// the pipeline. Its profile is tuned through the Alsa.Latency.<mode>.BufferUs
+// and .RingUs config values. The ring depth applies in ring mode only, and
+// the device's own limits are applied when the buffer is set.
+
+class ModeLatency
+{
+    // As BufferTuner's.
+    static const TUint kMinBufferUs = 5000;
+    static const TUint kMaxBufferUs = 500000;
+    static const TUint kMaxRingUs   = 500000;
+public:
+    ModeLatency(Configuration::IConfigInitialiser& aConfigInit,
+                TUint aBufferUs, TUint aRingUs);
+    ~ModeLatency();
+    void  Select(const Brx& aMode);
+    TUint BufferUs() const;
+    TUint RingUs() const;
+private:
+    class ModeConfig
+    {
+    public:
+        ModeConfig(Configuration::IConfigInitialiser& aConfigInit,
+                   const TChar* aMode, TUint aBufferUs, TUint aRingUs);
+        ~ModeConfig();
+        const TChar* Mode() const;
+        TUint BufferUs() const;
+        TUint RingUs() const;
+    private:
+        void BufferChanged(Configuration::KeyValuePair<TInt>& aKvp);
+        void RingChanged(Configuration::KeyValuePair<TInt>& aKvp);
+    private:
+        const TChar*              iMode;
+        Configuration::ConfigNum* iBuffer;
+        Configuration::ConfigNum* iRing;
+        TUint                     iBufferSubscriberId;
+        TUint                     iRingSubscriberId;
+        std::atomic<TUint>        iBufferUs;   // set on the config thread
+        std::atomic<TUint>        iRingUs;
+    };
+private:
+    const TUint              iDefaultBufferUs;
+    const TUint              iDefaultRingUs;
+    std::vector<ModeConfig*> iModes;
+    TUint                    iBufferUs;
+    TUint                    iRingUs;
+};
+
+static const struct
+{
+    const TChar* iMode;
+    TUint        iBufferUs;
+    TUint        iRingUs;
+} kModeLatencies[] =
+{
+    { "Receiver", 10000, 10000 },
+};
+
+ModeLatency::ModeConfig::ModeConfig(Configuration::IConfigInitialiser& aConfigInit,
+                                    const TChar* aMode, TUint aBufferUs,
+                                    TUint aRingUs)
+: iMode(aMode)
+, iBufferUs(aBufferUs)
+, iRingUs(aRingUs)
+{
+    Bws<64> prefix("Alsa.Latency.");
+    prefix.Append(aMode);
+    prefix.Append('.');
+
+    Bws<64> key(prefix);
+    key.Append("BufferUs");
+
+    iBuffer = new Configuration::ConfigNum(aConfigInit, key, kMinBufferUs,
+                                           kMaxBufferUs, aBufferUs);
+    iBufferSubscriberId = iBuffer->Subscribe(
+        Configuration::MakeFunctorConfigNum(*this,
+                                            &ModeConfig::BufferChanged));
+
+    key.Replace(prefix);
+    key.Append("RingUs");
+
+    iRing = new Configuration::ConfigNum(aConfigInit, key, 0, kMaxRingUs,
+                                         aRingUs);
+    iRingSubscriberId = iRing->Subscribe(
+        Configuration::MakeFunctorConfigNum(*this, &ModeConfig::RingChanged));
+}
+
+ModeLatency::ModeConfig::~ModeConfig()
+{
+    iRing->Unsubscribe(iRingSubscriberId);
+    delete iRing;
+    iBuffer->Unsubscribe(iBufferSubscriberId);
+    delete iBuffer;
+}
+
+const TChar* ModeLatency::ModeConfig::Mode() const
+{
+    return iMode;
+}
+
+TUint ModeLatency::ModeConfig::BufferUs() const
+{
+    return iBufferUs;
+}
+
+TUint ModeLatency::ModeConfig::RingUs() const
+{
+    return iRingUs;
+}
+
+void ModeLatency::ModeConfig::BufferChanged(
+    Configuration::KeyValuePair<TInt>& aKvp)
+{
+    // Taken up when the mode is next selected.
+    iBufferUs = (TUint)aKvp.Value();
+}
+
+void ModeLatency::ModeConfig::RingChanged(
+    Configuration::KeyValuePair<TInt>& aKvp)
+{
+    iRingUs = (TUint)aKvp.Value();
+}
+
+ModeLatency::ModeLatency(Configuration::IConfigInitialiser& aConfigInit,
+                         TUint aBufferUs, TUint aRingUs)
+: iDefaultBufferUs(aBufferUs)
+, iDefaultRingUs(aRingUs)
+, iBufferUs(aBufferUs)
+, iRingUs(aRingUs)
+{
+    for (const auto& latency : kModeLatencies)
+    {
+        iModes.push_back(new ModeConfig(aConfigInit, latency.iMode,
+                                        latency.iBufferUs, latency.iRingUs));
+    }
+}
+
+ModeLatency::~ModeLatency()
+{
+    for (ModeConfig* mode : iModes)
+    {
+        delete mode;
+    }
+}
+
+void ModeLatency::Select(const Brx& aMode)
+{
+    iBufferUs = iDefaultBufferUs;
+    iRingUs   = iDefaultRingUs;
+
+    for (const ModeConfig* mode : iModes)
+    {
+        if (aMode == Brn(mode->Mode()))
+        {
+            iBufferUs = mode->BufferUs();
+            iRingUs   = mode->RingUs();
+            break;
+        }
+    }
+
+    // Direct mode has no writer thread to fill a ring.
+    if (iDefaultRingUs == 0)
+    {
+        iRingUs = 0;
+    }
+
+    Log::Print("DriverAlsa: Mode %.*s, buffer %u us, ring %u us\n",
+               PBUF(aMode), iBufferUs, iRingUs);
+}
+
+TUint ModeLatency::BufferUs() const
+{
+    return iBufferUs;
+}
+
+TUint ModeLatency::RingUs() const
+{
+    return iRingUs;
+}
+
+// IdleTimer
+//
+// When to close the PCM after the pipeline halts. An open, prepared PCM
+// keeps some USB DACs out of their low power state and the ring writer
+// waiting on the device. Two config values control it:
+//
+//   Alsa.Idle.PowerDownSecs   halted this long before closing, 0 never
+//   Alsa.Idle.ColdStartMs     the longest reopening may take. A device
+//                             slower than this is left open from then on.
+//
+// The timer runs on its own thread, as the animator is blocked in Pull()
+// while the pipeline is halted. It calls aExpired once the halt has lasted
+// the time, and aExpired should check Expired() under the animator's lock
+// in case playing has started since.
+
+class IdleTimer
+{
+    static const TUint kDefaultPowerDownSecs = 120;
+    static const TUint kMaxPowerDownSecs = 24 * 60 * 60;
+    static const TUint kDefaultColdStartMs = 100;
+    static const TUint kMaxColdStartMs = 10000;
+public:
+    IdleTimer(Configuration::IConfigInitialiser& aConfigInit,
+              Functor aExpired);
+    ~IdleTimer();
+    void  Start();
+    void  Stop();
+    TBool Expired() const;
+    // How long the PCM took to reopen.
+    void  ColdStart(TUint aUs);
+private:
+    void  PowerDownChanged(Configuration::KeyValuePair<TInt>& aKvp);
+    void  ColdStartChanged(Configuration::KeyValuePair<TInt>& aKvp);
+    void  Run();
+private:
+    Configuration::ConfigNum* iPowerDownConfig;
+    Configuration::ConfigNum* iColdStartConfig;
+    TUint                     iPowerDownSubscriberId;
+    TUint                     iColdStartSubscriberId;
+    std::atomic<TUint>        iPowerDownSecs;
+    std::atomic<TUint>        iColdStartMs;
+    Functor                   iExpired;
+    Semaphore                 iSignal;
+    std::atomic<TBool>        iTooSlow;     // to reopen, so left open
+    std::atomic<TBool>        iRunning;
+    std::atomic<TBool>        iQuit;
+    ThreadFunctor*            iThread;
+};
+
+IdleTimer::IdleTimer(Configuration::IConfigInitialiser& aConfigInit,
+                     Functor aExpired)
+: iPowerDownSecs(kDefaultPowerDownSecs)
+, iColdStartMs(kDefaultColdStartMs)
+, iExpired(aExpired)
+, iSignal("ALIT", 0)
+, iTooSlow(false)
+, iRunning(false)
+, iQuit(false)
+{
+    iPowerDownConfig = new Configuration::ConfigNum(
+        aConfigInit, Brn("Alsa.Idle.PowerDownSecs"), 0, kMaxPowerDownSecs,
+        kDefaultPowerDownSecs);
+    iPowerDownSubscriberId = iPowerDownConfig->Subscribe(
+        Configuration::MakeFunctorConfigNum(*this,
+                                            &IdleTimer::PowerDownChanged));
+
+    iColdStartConfig = new Configuration::ConfigNum(
+        aConfigInit, Brn("Alsa.Idle.ColdStartMs"), 1, kMaxColdStartMs,
+        kDefaultColdStartMs);
+    iColdStartSubscriberId = iColdStartConfig->Subscribe(
+        Configuration::MakeFunctorConfigNum(*this,
+                                            &IdleTimer::ColdStartChanged));
+
+    iThread = new ThreadFunctor("AlsaIdle",
+                                MakeFunctor(*this, &IdleTimer::Run),
+                                kPriorityNormal);
+    iThread->Start();
+}
+
+IdleTimer::~IdleTimer()
+{
+    iQuit = true;
+    iSignal.Signal();
+    delete iThread;
+
+    iColdStartConfig->Unsubscribe(iColdStartSubscriberId);
+    delete iColdStartConfig;
+    iPowerDownConfig->Unsubscribe(iPowerDownSubscriberId);
+    delete iPowerDownConfig;
+}
+
+void IdleTimer::PowerDownChanged(Configuration::KeyValuePair<TInt>& aKvp)
+{
+    // Taken up at the next halt.
+    iPowerDownSecs = (TUint)aKvp.Value();
+
+    if (iPowerDownSecs == 0)
+    {
+        Log::Print("DriverAlsa: Device left open when idle\n");
+    }
+    else
+    {
+        Log::Print("DriverAlsa: Device closed after %u s idle\n",
+                   iPowerDownSecs.load());
+    }
+}
+
+void IdleTimer::ColdStartChanged(Configuration::KeyValuePair<TInt>& aKvp)
+{
+    iColdStartMs = (TUint)aKvp.Value();
+}
+
+void IdleTimer::Start()
+{
+    if (iPowerDownSecs == 0 || iTooSlow)
+    {
+        return;
+    }
+
+    iRunning = true;
+    iSignal.Signal();
+}
+
+void IdleTimer::Stop()
+{
+    if (iRunning.exchange(false))
+    {
+        iSignal.Signal();
+    }
+}
+
+TBool IdleTimer::Expired() const
+{
+    // Only the timer's own thread asks, once it has run its time, so
+    // still running means still halted.
+    return iRunning;
+}
+
+void IdleTimer::ColdStart(TUint aUs)
+{
+    Log::Print("DriverAlsa: Device reopened in %u us\n", aUs);
+
+    const TUint coldStartMs = iColdStartMs;
+
+    if (aUs > coldStartMs * 1000 && !iTooSlow.exchange(true))
+    {
+        Log::Print("DriverAlsa: Reopening is slower than %u ms, the device "
+                   "will be left open\n", coldStartMs);
     }
 }
 
-IPcmProcessor& Profile::GetPcmProcessor() const
+void IdleTimer::Run()
 {
-    return *iPcmProcessor;
+    while (!iQuit)
+    {
+        if (!iRunning)
+        {
+            iSignal.Wait();
+            continue;
+        }
+
+        iSignal.Clear();
+
+        // Turned off since the halt.
+        const TUint powerDownSecs = iPowerDownSecs;
+
+        if (powerDownSecs == 0)
+        {
+            iRunning = false;
+            continue;
+        }
+
+        try
+        {
+            // Cut short by playing again, halting again or quitting.
+            iSignal.Wait(powerDownSecs * 1000);
+        }
+        catch (Timeout&)
+        {
+            iExpired();
+
+            // Nothing more to do until the next start or stop.
+            iSignal.Wait();
+        }
+    }
 }
 
 /*  Pimpl
@@ -618,107 +1475,1431 @@ IPcmProcessor& Profile::GetPcmProcessor() const
 class DriverAlsa::Pimpl : public IDataSink
 {
 public:
-    Pimpl(const TChar* aAlsaDevice, TUint aBufferUs);
+    Pimpl(Configuration::IStoreReadWrite& aStore,
+          Configuration::IConfigInitialiser& aConfigInit,
+          ClockPullerAlsa& aClockPuller, const TChar* aAlsaDevice,
+          TUint aBufferUs, TUint aRingUs);
     virtual ~Pimpl();
     void ProcessDecodedStream(MsgDecodedStream* aMsg);
     void ProcessPlayable(MsgPlayable* aMsg);
     void ProcessDrain();
+    void ProcessHalt();
+    void ProcessMode(const Brx& aMode);
+    void Reopen(const TChar* aAlsaDevice);
+    void SetResamplerQuality(ResamplerQuality aQuality);
     void LogPCMState();
     TUint DriverDelayJiffies(TUint aSampleRate);
-public:
-    virtual void Write(const Brx& aData);
+    TUint BufferJiffies() const;
+    TUint MaxBitDepth() const;
+    TUint MaxSampleRate() const;
+    const ConversionArena& Arena() const;
+    RealtimePolicy& Realtime();
+    StreamChangeStats& StreamStats();
+    DriverHealth& Health();
+    Mutex& AnimatorLock();
+public: // IDataSink
+    TByte* Acquire(TUint& aBytes) override;
+    void   Commit(TUint aBytes) override;
 private:
-    TBool TryProfile(Profile& aProfile, TUint aBitDepth, TUint aNumChannels,
-                     TUint aSampleRate, TUint aBufferUs);
+    TBool  Open(const TChar* aAlsaDevice, TBool aProbe);
+    void   OpenOrFallBack(const TChar* aAlsaDevice);
+    void   Close();
+    void   Wake();
+    void   PowerDown();
+    void   PowerUp();
+    TBool  RestoreConfiguration();
+    TByte* AcquireMmap(TUint& aBytes);
+    void   CommitMmap(TUint aBytes);
+    void   Write(const Brx& aData);
+    void   FlushPending();
+    TBool  Recover(TInt aError);
+    void   SamplePeriod(TUint aFrames);
+    TByte* AcquireRing(TUint& aBytes);
+    void   CommitRing(TUint aBytes);
+    void   Drain();
+    void   BeginDrain();
+    void   StartDrain();
+    TBool  PollDrain(TUint aWaitMs);
+    void   WaitForDrain();
+    void   CancelDrain();
+    void   Pause();
+    void   Resume();
+    void   Discard();
+    void   AwaitSound(LatencyHistogram& aToSound,
+                      std::chrono::steady_clock::time_point aSince);
+    void   EmptyRing();
+    void   WriterThread();
+    TBool  RingReady() const;
+    void   WaitForWriterWork(TBool aDevice);
+    void   WakeWriter();
+    void ConfigureStream(TUint aBitDepth, TUint aSampleRate,
+                         TUint aNumChannels);
+    void UpdateResampleDelay();
+    const Profile* FindProfile(TUint aBitDepth) const;
+    TBool TryFormat(OutputFormat aFormat, TUint aNumChannels,
+                    TUint aSampleRate, TUint aBufferUs);
+    TBool SetParams(snd_pcm_format_t aFormat, snd_pcm_access_t aAccess,
+                    TUint aNumChannels, TUint aSampleRate, TUint aBufferUs);
+    void  CheckXruns();
 private:
     snd_pcm_t* iHandle;
-    Bwh iSampleBuffer;  // buffer ProcessSampleX data
-    TUint iSampleBytes;
+    Mutex iHandleLock;      // held while the handle is replaced
+    RealtimePolicy iRealtime;
+    VirtualSink iSink;      // active when the device is one of its sinks
+    ConversionArena iArena;
+    ClockPullerAlsa& iClockPuller;
+    PcmProcessorAlsa iPcmProcessor;
+    TBool iMmap;
+    snd_pcm_uframes_t iMmapOffset;
+    snd_pcm_uframes_t iMmapFrames;
+    TByte* iMmapArea;
+    // Set as each stream starts, and read by delay queries on the
+    // pipeline's threads.
+    std::atomic<TUint> iSampleBytes;
+    std::atomic<TUint> iPeriodBytes;
+    std::atomic<TUint> iPendingBytes;   // converted, not yet given to ALSA
     TBool iDuplicateChannel;
     std::vector<Profile> iProfiles;
-    TInt iProfileIndex;
+    TBool iConfigured;
+    TUint iStreamBitDepth;
+    TUint iStreamSampleRate;
+    TUint iStreamNumChannels;
+    StreamChangeStats iStreamStats;
+    DriverHealth iHealth;
+    DeviceCaps iCaps;
+    std::atomic<TUint> iMaxBitDepth;    // of iCaps, for the pipeline's threads
+    std::atomic<TUint> iMaxSampleRate;
     TBool iDitch;
-    TUint iBytesSent;
-    TUint iBufferUs;
-
-    static const TUint kSampleBufSize = 16 * 1024;
+    std::atomic<TUint> iBytesSent;
+
+    // Resampling of rates the device can't play.
+    std::atomic<TUint> iResamplerQuality;
+    ResamplerQuality iConfiguredQuality;
+    std::atomic<TUint> iDeviceRate;
+    std::atomic<TUint> iResampleDelayJiffies;
+
+    // Buffer sizing.
+    ModeLatency iLatency;
+    BufferTuner iTuner;
+    TUint iConfiguredBufferUs;
+    TUint iConfiguredRingUs;
+    std::atomic<TUint> iBufferJiffies;
+    std::atomic<TUint> iXruns;
+    TUint iXrunsSeen;
+    std::chrono::steady_clock::time_point iStableSince;
+
+    // Ring mode, used when aRingUs is non zero.
+    PcmRing iRing;
+    TUint iRingUs;
+    Semaphore iRingSpace;
+    ThreadFunctor* iWriter;
+    std::atomic<TBool> iWriterWaiting;
+    std::atomic<TBool> iWriterQuit;
+    std::atomic<TBool> iRingFlush;
+    TInt iWakeFd;
+    std::vector<pollfd> iPollFds;
+
+    // Pausing while the pipeline is halted.
+    Mutex iWriterLock;      // held while the writer uses the PCM, taken
+                            // after iHandleLock where both are held
+    TBool iCanPause;
+    std::atomic<TBool> iPaused;
+    TBool iDropped;         // paused by snd_pcm_drop(), not snd_pcm_pause()
+
+    // Discarding queued audio on seeks, skips and source switches.
+    static const TUint kMaxModeBytes = 64;
+    Bws<kMaxModeBytes> iMode;
+    TUint iStreamId;
+    std::chrono::steady_clock::time_point iDiscardTime;
+    std::atomic<LatencyHistogram*> iAwaitingSound;  // until the PCM restarts
+
+    // Closing the PCM while the pipeline stays halted.
+    Mutex iAnimatorLock;    // held by the animator while it deals with a msg
+    IdleTimer* iIdle;
+    TBool iPoweredDown;
+    TBool iWasConfigured;   // before powering down
+    OutputFormat iOutputFormat;
+    Bws<DriverAlsa::kMaxDeviceBytes> iDeviceName;
+
+    // Playing out what is queued without holding up the animator. In ring
+    // mode the writer plays the ring up to the drain point, iDrainBytes
+    // on, then drains the PCM. Audio queued behind waits until it has.
+    std::atomic<TBool> iDrainPending;
+    std::atomic<TBool> iDraining;   // snd_pcm_drain() issued, not yet done
+    TUint iDrainBytes;
+    std::chrono::steady_clock::time_point iDrainStart;
+
+    static const TUint kPeriods = 4;        // per buffer, when the device allows
+    static const TUint kDrainPollMs = 100;  // between looks at a draining PCM
+    static const TUint kDrainTimeoutMs = 2000;
+    static const TUint kStableSecs = 60;    // clean playback before shrinking
 };
 
-DriverAlsa::Pimpl::Pimpl(const TChar* aAlsaDevice, TUint aBufferUs)
+const TUint DriverAlsa::Pimpl::kStableSecs;
+const TUint DriverAlsa::Pimpl::kMaxModeBytes;
+
+DriverAlsa::Pimpl::Pimpl(Configuration::IStoreReadWrite& aStore,
+                         Configuration::IConfigInitialiser& aConfigInit,
+                         ClockPullerAlsa& aClockPuller,
+                         const TChar* aAlsaDevice, TUint aBufferUs,
+                         TUint aRingUs)
 : iHandle(nullptr)
-, iSampleBuffer(kSampleBufSize)
+, iHandleLock("ALHL")
+, iRealtime(aConfigInit)
+, iSink(aStore)
+, iClockPuller(aClockPuller)
+, iPcmProcessor(*this)
+, iMmap(false)
+, iMmapOffset(0)
+, iMmapFrames(0)
+, iMmapArea(nullptr)
 , iSampleBytes(0)
+, iPeriodBytes(0)
+, iPendingBytes(0)
 , iDuplicateChannel(false)
-, iProfileIndex(-1)
+, iConfigured(false)
+, iStreamBitDepth(0)
+, iStreamSampleRate(0)
+, iStreamNumChannels(0)
+, iMaxBitDepth(0)
+, iMaxSampleRate(0)
 , iDitch(false)
 , iBytesSent(0)
-, iBufferUs(aBufferUs)
+, iResamplerQuality(eResamplerOff)
+, iConfiguredQuality(eResamplerOff)
+, iDeviceRate(0)
+, iResampleDelayJiffies(0)
+, iLatency(aConfigInit, aBufferUs, aRingUs)
+, iTuner(aStore, aBufferUs)
+, iConfiguredBufferUs(0)
+, iConfiguredRingUs(0)
+, iBufferJiffies(0)
+, iXruns(0)
+, iXrunsSeen(0)
+, iStableSince(std::chrono::steady_clock::now())
+, iRingUs(aRingUs)
+, iRingSpace("ARSP", 0)
+, iWriter(nullptr)
+, iWriterWaiting(false)
+, iWriterQuit(false)
+, iRingFlush(false)
+, iWakeFd(-1)
+, iWriterLock("ALWL")
+, iCanPause(false)
+, iPaused(false)
+, iDropped(false)
+, iStreamId(0)
+, iAwaitingSound(nullptr)
+, iAnimatorLock("ALAL")
+, iIdle(nullptr)
+, iPoweredDown(false)
+, iWasConfigured(false)
+, iDrainPending(false)
+, iDraining(false)
+, iDrainBytes(0)
 {
-    auto err = snd_pcm_open(&iHandle, aAlsaDevice, SND_PCM_STREAM_PLAYBACK, 0);
-    ASSERT(err == 0);
+    Log::Print("DriverAlsa: Using %s PCM conversion kernels\n",
+               PcmKernels::Instance().Name());
+
+    const OutputFormat s16(SND_PCM_FORMAT_S16_LE, 2);
+    const OutputFormat s24Packed(SND_PCM_FORMAT_S24_3LE, 3);
+    const OutputFormat s24(SND_PCM_FORMAT_S24_LE, 4);
+    const OutputFormat s32(SND_PCM_FORMAT_S32_LE, 4);
+
+    iProfiles.push_back(Profile(32, { s32, s24Packed, s24, s16 }));
+    iProfiles.push_back(Profile(24, { s24Packed, s24, s32, s16 }));
+    iProfiles.push_back(Profile(16, { s16, s24Packed, s24, s32 }));
+    iProfiles.push_back(Profile(8,  { s16, s24Packed, s24, s32 }));
 
-    // PcmProcessorLe with S32 support
-    iProfiles.emplace_back(new PcmProcessorLe32(*this, iSampleBuffer),
-            OutputFormat(SND_PCM_FORMAT_S32_LE, 4),  // S32 -> S32
-            OutputFormat(SND_PCM_FORMAT_S32_LE, 4),  // S24 -> S32
-            OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S16
-            OutputFormat(SND_PCM_FORMAT_S16_LE, 2)); // U8 -> S16
+    Log::Print("DriverAlsa: %s mode, %u us ring\n",
+               (iRingUs != 0) ? "Ring" : "Direct", iRingUs);
 
-    // PcmProcessorLe without S32 support
-    iProfiles.emplace_back(new PcmProcessorLe(*this, iSampleBuffer),
-            OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S32 -> S16
-            OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S24 -> S16
-            OutputFormat(SND_PCM_FORMAT_S16_LE, 2),  // S16
-            OutputFormat(SND_PCM_FORMAT_S16_LE, 2)); // U8 -> S16
+    // Before the writer thread starts, so its stack is locked too.
+    iRealtime.LockMemory();
+
+    OpenOrFallBack(aAlsaDevice);
+
+    iIdle = new IdleTimer(aConfigInit, MakeFunctor(*this, &Pimpl::PowerDown));
 }
 
 DriverAlsa::Pimpl::~Pimpl()
 {
-    auto err = snd_pcm_close(iHandle);
-    ASSERT(err == 0);
+    delete iIdle;
+    Close();
 }
 
-void DriverAlsa::Pimpl::ProcessPlayable(MsgPlayable* aMsg)
+TBool DriverAlsa::Pimpl::Open(const TChar* aAlsaDevice, TBool aProbe)
 {
-    if (! iDitch)
-    	aMsg->Read(iProfiles[iProfileIndex].GetPcmProcessor());
-}
+    int err;
 
-void DriverAlsa::Pimpl::ProcessDrain()
-{
-    // Wait for the native audio buffers to empty.
-    if (iProfileIndex != -1)
+    if (VirtualSink::Is(aAlsaDevice))
     {
-        // Drain the PCM buffers.
-        auto err = snd_pcm_drain(iHandle);
-        if (err < 0)
-        {
-            Log::Print("DriverAlsa: snd_pcm_drain() error : %s\n",
-                       snd_strerror(err));
-            ASSERTS();
-        }
-
-        // Prepare the PCM to accept new data.
-        err = snd_pcm_prepare(iHandle);
+        err = iSink.Open(&iHandle, aAlsaDevice);
+    }
+    else
+    {
+        iSink.Close();
+        err = snd_pcm_open(&iHandle, aAlsaDevice, SND_PCM_STREAM_PLAYBACK, 0);
+    }
+
+    if (err < 0)
+    {
+        Log::Print("DriverAlsa: Cannot open %s : %s\n", aAlsaDevice,
+                   snd_strerror(err));
+        iHandle = nullptr;
+        return false;
+    }
+
+    Log::Print("DriverAlsa: Opened %s\n", aAlsaDevice);
+
+    iDeviceName.Replace(Brn(aAlsaDevice));
+
+    // Reopening the same device after powering down keeps what was
+    // learnt of it.
+    if (aProbe)
+    {
+        iCaps.Probe(iHandle);
+        iCaps.Dump();
+
+        iMaxBitDepth   = iCaps.MaxBitDepth();
+        iMaxSampleRate = iCaps.MaxRate();
+        iTuner.Load(aAlsaDevice);
+    }
+
+    // Slot 0 is the ring writer's wake descriptor, the rest are the
+    // device's. Drains wait on the device's too.
+    iPollFds.resize(1 + snd_pcm_poll_descriptors_count(iHandle));
+
+    if (iRingUs != 0)
+    {
+        // The writer thread waits in poll() on the device, so the PCM is
+        // non-blocking in ring mode.
+        err = snd_pcm_nonblock(iHandle, 1);
+        ASSERT(err == 0);
+
+        iWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ASSERT(iWakeFd >= 0);
+
+        iWriterQuit = false;
+        iWriter = new ThreadFunctor("AlsaWriter",
+                                    MakeFunctor(*this, &Pimpl::WriterThread),
+                                    kPrioritySystemHighest);
+        iWriter->Start();
+    }
+
+    return true;
+}
+
+void DriverAlsa::Pimpl::OpenOrFallBack(const TChar* aAlsaDevice)
+{
+    // Without sound hardware even "default" may not open, so carry on
+    // into the null sink rather than stop. Playing into nothing is easily
+    // mistaken for a working device, so the "alsa" command shows it.
+    if (!Open(aAlsaDevice, true) &&
+        !Open(ConfigAlsaDevice::kDefaultDevice, true))
+    {
+        const TBool opened = Open(VirtualSink::kDevices[0], true);
+        ASSERT(opened);
+    }
+
+    const Brn requested(aAlsaDevice);
+
+    if (iDeviceName != requested)
+    {
+        Log::Print("DriverAlsa: Falling back to %s, %s failed to open\n",
+                   iDeviceName.PtrZ(), aAlsaDevice);
+    }
+
+    iHealth.Opened(iDeviceName, requested);
+}
+
+void DriverAlsa::Pimpl::Close()
+{
+    if (iWriter != nullptr)
+    {
+        iWriterQuit = true;
+        WakeWriter();
+        delete iWriter;
+        iWriter = nullptr;
+        close(iWakeFd);
+        iWakeFd = -1;
+    }
+
+    if (iHandle != nullptr)
+    {
+        auto err = snd_pcm_close(iHandle);
+        ASSERT(err == 0);
+        iHandle = nullptr;
+    }
+
+    iTuner.Save();
+}
+
+void DriverAlsa::Pimpl::Reopen(const TChar* aAlsaDevice)
+{
+    // A device closed while idle is brought back first, so that the new
+    // one takes over the stream it had and is closed in its turn.
+    const TBool poweredDown = iPoweredDown;
+
+    if (poweredDown)
+    {
+        PowerUp();
+    }
+
+    // Play out what the old device has, then carry on with the current
+    // stream on the new one.
+    const TBool configured = iConfigured;
+
+    if (configured)
+    {
+        Drain();
+    }
+
+    {
+        AutoMutex _(iHandleLock);
+
+        Close();
+        OpenOrFallBack(aAlsaDevice);
+
+        iConfigured = false;
+        iMmapFrames = 0;
+    }
+
+    if (configured)
+    {
+        ConfigureStream(iStreamBitDepth, iStreamSampleRate,
+                        iStreamNumChannels);
+    }
+
+    if (poweredDown)
+    {
+        iIdle->Start();
+    }
+}
+
+void DriverAlsa::Pimpl::SetResamplerQuality(ResamplerQuality aQuality)
+{
+    // Taken up when the next stream starts.
+    iResamplerQuality = aQuality;
+}
+
+void DriverAlsa::Pimpl::ProcessPlayable(MsgPlayable* aMsg)
+{
+    Wake();
+    Resume();
+    CheckXruns();
+
+    if (! iDitch)
+    {
+        iPcmProcessor.SetRatePpb(iClockPuller.RatePpb());
+    	aMsg->Read(iPcmProcessor);
+    }
+}
+
+void DriverAlsa::Pimpl::CheckXruns()
+{
+    const TUint xruns = iXruns;
+
+    if (xruns == iXrunsSeen)
+    {
+        return;
+    }
+
+    iXrunsSeen   = xruns;
+    iStableSince = std::chrono::steady_clock::now();
+
+    // Reconfiguring now would drain and reprime the device mid stream,
+    // so the bigger buffer is only noted. Like a shrink, it is made when
+    // the next stream configures the device.
+    if (iConfigured)
+    {
+        iTuner.Grow();
+    }
+}
+
+void DriverAlsa::Pimpl::ProcessDrain()
+{
+    // Let the native audio buffers empty in the background. The next
+    // stream's audio is converted meanwhile, and goes to the PCM once it
+    // has drained and been prepared again.
+    if (iConfigured)
+    {
+        BeginDrain();
+    }
+}
+
+void DriverAlsa::Pimpl::ProcessHalt()
+{
+    // Nothing more is coming for now. A pause or stop has ramped down to
+    // silence, so stop the device where it is, rather than let it run dry
+    // and count that as an underrun, and playing resumes within a period.
+    // A halt straight after audio is the end of the queue, and the end of
+    // the last track is still to be heard, so that is played out.
+    if (iConfigured)
+    {
+        if (iPcmProcessor.Quiet())
+        {
+            Pause();
+        }
+        else
+        {
+            BeginDrain();
+        }
+    }
+
+    iIdle->Start();
+}
+
+void DriverAlsa::Pimpl::Wake()
+{
+    iIdle->Stop();
+
+    if (iPoweredDown)
+    {
+        PowerUp();
+    }
+}
+
+void DriverAlsa::Pimpl::PowerDown()
+{
+    AutoMutex _(iAnimatorLock);
+
+    // Playing again since the timer ran out.
+    if (!iIdle->Expired() || iPoweredDown)
+    {
+        return;
+    }
+
+    {
+        AutoMutex __(iWriterLock);
+        CancelDrain();
+    }
+
+    {
+        AutoMutex __(iHandleLock);
+        Close();
+    }
+
+    // The writer has gone with the PCM. What the ring held at the halt
+    // would be stale by the time anything plays, so it goes too.
+    EmptyRing();
+
+    iPendingBytes = 0;
+    iMmapFrames   = 0;
+    iPaused       = false;
+    iDropped      = false;
+    iSink.Reset();
+
+    iWasConfigured = iConfigured;
+    iConfigured    = false;
+    iPoweredDown   = true;
+
+    iHealth.PoweredDown();
+
+    Log::Print("DriverAlsa: Idle, %s closed\n", iDeviceName.PtrZ());
+}
+
+void DriverAlsa::Pimpl::PowerUp()
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    Bws<DriverAlsa::kMaxDeviceBytes> device(iDeviceName);
+    TBool                            reopened;
+
+    {
+        AutoMutex _(iHandleLock);
+
+        reopened = Open(device.PtrZ(), false);
+
+        // Gone while idle, perhaps unplugged.
+        if (!reopened)
+        {
+            OpenOrFallBack(device.PtrZ());
+        }
+    }
+
+    iPoweredDown = false;
+
+    // The same device comes back with the same configuration, which saves
+    // probing it and searching for a format. Anything else starts afresh.
+    if (iWasConfigured && !(reopened && RestoreConfiguration()))
+    {
+        ConfigureStream(iStreamBitDepth, iStreamSampleRate,
+                        iStreamNumChannels);
+    }
+
+    const TUint us = MicrosecondsSince(start);
+
+    iHealth.ColdStart().Record(us);
+    iIdle->ColdStart(us);
+}
+
+TBool DriverAlsa::Pimpl::RestoreConfiguration()
+{
+    const TUint deviceRate = iDeviceRate;
+
+    if (!TryFormat(iOutputFormat, iStreamNumChannels, deviceRate,
+                   iConfiguredBufferUs))
+    {
+        return false;
+    }
+
+    // The conversion, ring and arena are all sized for the period had
+    // before, so it must come back the same.
+    snd_pcm_uframes_t bufferFrames = 0;
+    snd_pcm_uframes_t periodFrames = 0;
+
+    if (snd_pcm_get_params(iHandle, &bufferFrames, &periodFrames) < 0 ||
+        periodFrames * iSampleBytes != iPeriodBytes)
+    {
+        return false;
+    }
+
+    iSink.Start(deviceRate, bufferFrames);
+
+    iConfigured = true;
+
+    return true;
+}
+
+void DriverAlsa::Pimpl::Pause()
+{
+    // A drain under way is left to finish.
+    if (iPaused || iDrainPending || iDraining)
+    {
+        return;
+    }
+
+    // The tail of the last period goes into the device, or the ring, so
+    // that it plays on resuming.
+    FlushPending();
+
+    AutoMutex _(iWriterLock);
+
+    iPaused  = true;
+    iDropped = false;
+
+    if (snd_pcm_state(iHandle) != SND_PCM_STATE_RUNNING)
+    {
+        // Not started, so already still.
+        return;
+    }
+
+    // A simulated DAC simply starts again.
+    iSink.Reset();
+
+    if (iCanPause)
+    {
+        auto err = snd_pcm_pause(iHandle, 1);
+        if (err == 0)
+        {
+            return;
+        }
+
+        Log::Print("DriverAlsa: snd_pcm_pause() error : %s\n",
+                   snd_strerror(err));
+    }
+
+    // The device can't hold its place, so throw away what it has. Audio
+    // still in the ring is kept.
+    snd_pcm_drop(iHandle);
+    iDropped = true;
+}
+
+void DriverAlsa::Pimpl::Resume()
+{
+    if (!iPaused)
+    {
+        return;
+    }
+
+    {
+        AutoMutex _(iWriterLock);
+
+        const snd_pcm_state_t state = snd_pcm_state(iHandle);
+
+        if (state == SND_PCM_STATE_PAUSED)
+        {
+            auto err = snd_pcm_pause(iHandle, 0);
+            if (err < 0)
+            {
+                Log::Print("DriverAlsa: snd_pcm_pause() error : %s\n",
+                           snd_strerror(err));
+                iDropped = true;
+            }
+        }
+
+        if (iDropped || state == SND_PCM_STATE_SETUP)
+        {
+            auto err = snd_pcm_prepare(iHandle);
+            if (err < 0)
+            {
+                Log::Print("DriverAlsa: snd_pcm_prepare() error : %s\n",
+                           snd_strerror(err));
+            }
+        }
+
+        iPaused  = false;
+        iDropped = false;
+    }
+
+    // Whatever the ring held when paused is ready to go again.
+    if (iWriter != nullptr && RingReady() && iWriterWaiting.exchange(false))
+    {
+        WakeWriter();
+    }
+}
+
+void DriverAlsa::Pimpl::ProcessMode(const Brx& aMode)
+{
+    const auto now = std::chrono::steady_clock::now();
+    const Brn  mode(aMode.Ptr(), std::min(aMode.Bytes(), kMaxModeBytes));
+
+    // The old source's audio has no place in the new one, and the new
+    // one may want a different latency. That takes effect when its first
+    // stream configures the device.
+    if (mode != iMode)
+    {
+        Discard();
+        AwaitSound(iHealth.SkipToSound(), now);
+        iMode.Replace(mode);
+
+        iLatency.Select(iMode);
+        iTuner.Select(iMode, iLatency.BufferUs());
+    }
+}
+
+void DriverAlsa::Pimpl::Discard()
+{
+    if (!iConfigured)
+    {
+        return;
+    }
+
+    {
+        AutoMutex _(iWriterLock);
+
+        auto err = snd_pcm_drop(iHandle);
+        if (err == 0)
+        {
+            err = snd_pcm_prepare(iHandle);
+        }
+
+        if (err < 0)
+        {
+            Log::Print("DriverAlsa: Discard error : %s\n", snd_strerror(err));
+        }
+
+        iSink.Reset();
+
+        // The writer is held off, so the ring can be emptied from this
+        // side.
+        EmptyRing();
+        CancelDrain();
+
+        iPaused  = false;
+        iDropped = false;
+    }
+
+    // Converted audio not yet given to ALSA. An mmap area begun and not
+    // committed is simply abandoned.
+    iPendingBytes = 0;
+    iMmapFrames   = 0;
+
+    Log::Print("DriverAlsa: Queued audio discarded\n");
+}
+
+void DriverAlsa::Pimpl::AwaitSound(LatencyHistogram& aToSound,
+                                   std::chrono::steady_clock::time_point aSince)
+{
+    // Recorded by SamplePeriod() once the PCM is running again.
+    iDiscardTime   = aSince;
+    iAwaitingSound = &aToSound;
+}
+
+void DriverAlsa::Pimpl::EmptyRing()
+{
+    while (iRing.Bytes() != 0)
+    {
+        TUint bytes;
+        iRing.Read(bytes);
+        iRing.Consume(bytes);
+    }
+
+    iRingFlush = false;
+    iRingSpace.Signal();
+}
+
+// Fragments are gathered into whole ALSA periods before being handed to the
+// device, so there is one write per period however finely the pipeline
+// slices the audio. FlushPending() hands over a partial period.
+
+TByte* DriverAlsa::Pimpl::Acquire(TUint& aBytes)
+{
+    if (iWriter != nullptr)
+    {
+        return AcquireRing(aBytes);
+    }
+
+    if (iMmap)
+    {
+        return AcquireMmap(aBytes);
+    }
+
+    // Less than a frame can't be written, so write what there is and
+    // start the next period.
+    if (iPeriodBytes - iPendingBytes < iSampleBytes)
+    {
+        FlushPending();
+    }
+
+    const TUint pending = iPendingBytes;
+
+    if (aBytes > iPeriodBytes - pending)
+    {
+        aBytes = iPeriodBytes - pending;
+    }
+
+    return iArena.Acquire(iPeriodBytes) + pending;
+}
+
+void DriverAlsa::Pimpl::Commit(TUint aBytes)
+{
+    if (iWriter != nullptr)
+    {
+        CommitRing(aBytes);
+    }
+    else if (iMmap)
+    {
+        CommitMmap(aBytes);
+    }
+    else
+    {
+        iPendingBytes += aBytes;
+
+        if (iPendingBytes == iPeriodBytes)
+        {
+            FlushPending();
+        }
+    }
+}
+
+void DriverAlsa::Pimpl::FlushPending()
+{
+    if (iWriter != nullptr)
+    {
+        // The writer normally waits for a whole period.
+        iRingFlush = true;
+
+        if (iWriterWaiting.exchange(false))
+        {
+            WakeWriter();
+        }
+
+        return;
+    }
+
+    const TUint pending = iPendingBytes.exchange(0);
+
+    if (iMmap)
+    {
+        if (pending != 0)
+        {
+            const snd_pcm_uframes_t frames = pending / iSampleBytes;
+            auto committed = snd_pcm_mmap_commit(iHandle, iMmapOffset, frames);
+
+            if (committed < 0 || (snd_pcm_uframes_t)committed != frames)
+            {
+                if (committed >= 0)
+                {
+                    iHealth.ShortWrite();
+                }
+
+                Log::Print("DriverAlsa: snd_pcm_mmap_commit() error : %s\n",
+                           snd_strerror(committed < 0 ? committed : -EPIPE));
+                Recover(committed < 0 ? committed : -EPIPE);
+            }
+            else
+            {
+                iBytesSent += pending;
+                SamplePeriod(frames);
+                iSink.Wait();
+            }
+        }
+
+        // Whatever of the area wasn't written is simply not committed.
+        iMmapFrames = 0;
+    }
+    else if (pending != 0)
+    {
+        Write(Brn(iArena.Ptr(), pending));
+    }
+}
+
+TByte* DriverAlsa::Pimpl::AcquireMmap(TUint& aBytes)
+{
+    if (iMmapFrames != 0)
+    {
+        // Carry on filling the area already begun, unless what is left of
+        // it is less than a frame. Then commit it and begin another.
+        const TUint space = iMmapFrames * iSampleBytes - iPendingBytes;
+
+        if (space >= iSampleBytes)
+        {
+            if (aBytes > space)
+            {
+                aBytes = space;
+            }
+
+            return iMmapArea + iPendingBytes;
+        }
+
+        FlushPending();
+    }
+
+    // A drained PCM has no area to give until it is prepared again.
+    if (iDraining)
+    {
+        WaitForDrain();
+    }
+
+    // Begin a whole period, so it is committed as soon as it fills, and
+    // the converter never gets a sliver of the buffer.
+    const snd_pcm_uframes_t period = iPeriodBytes / iSampleBytes;
+    snd_pcm_uframes_t       frames = period;
+
+    for (;;)
+    {
+        auto avail = snd_pcm_avail_update(iHandle);
+
+        if (avail < 0)
+        {
+            if (!Recover(avail))
+            {
+                return nullptr;
+            }
+
+            continue;
+        }
+
+        if ((snd_pcm_uframes_t)avail < period)
+        {
+            TInt err;
+
+            // Playback starts once the buffer is full, as it would with
+            // snd_pcm_writei(). After that wait for the device to make a
+            // period of room, which is its avail_min.
+            if (snd_pcm_state(iHandle) == SND_PCM_STATE_PREPARED)
+            {
+                err = snd_pcm_start(iHandle);
+            }
+            else
+            {
+                const auto start = std::chrono::steady_clock::now();
+
+                err = snd_pcm_wait(iHandle, -1);
+
+                iHealth.WriteBlock().Record(MicrosecondsSince(start));
+            }
+
+            if (err < 0 && !Recover(err))
+            {
+                return nullptr;
+            }
+
+            continue;
+        }
+
+        // Possibly less than asked for, where the buffer wraps.
+        const snd_pcm_channel_area_t* areas;
+        auto err = snd_pcm_mmap_begin(iHandle, &areas, &iMmapOffset, &frames);
+
+        if (err < 0)
+        {
+            if (!Recover(err))
+            {
+                return nullptr;
+            }
+
+            continue;
+        }
+
+        // Interleaved, so every channel shares the first area.
+        iMmapFrames = frames;
+        iMmapArea   = (TByte*)areas[0].addr + areas[0].first / 8 +
+                      iMmapOffset * areas[0].step / 8;
+
+        if (aBytes > frames * iSampleBytes)
+        {
+            aBytes = frames * iSampleBytes;
+        }
+
+        return iMmapArea;
+    }
+}
+
+void DriverAlsa::Pimpl::CommitMmap(TUint aBytes)
+{
+    iPendingBytes += aBytes;
+
+    if (iPendingBytes == iMmapFrames * iSampleBytes)
+    {
+        FlushPending();
+    }
+}
+
+TByte* DriverAlsa::Pimpl::AcquireRing(TUint& aBytes)
+{
+    for (;;)
+    {
+        TUint  bytes = aBytes;
+        iRingSpace.Clear();
+        TByte* ptr   = iRing.Write(bytes);
+
+        if (bytes != 0)
+        {
+            aBytes = bytes;
+            return ptr;
+        }
+
+        // Full. The writer signals iRingSpace whenever it frees some.
+        iRingSpace.Wait();
+    }
+}
+
+void DriverAlsa::Pimpl::CommitRing(TUint aBytes)
+{
+    // More audio is coming, so any flush asked for has been overtaken.
+    iRingFlush = false;
+    iRing.Commit(aBytes);
+
+    // The writer waits for a whole period, so only wake it for one.
+    if (iRing.Bytes() >= iPeriodBytes && iWriterWaiting.exchange(false))
+    {
+        WakeWriter();
+    }
+}
+
+void DriverAlsa::Pimpl::Drain()
+{
+    BeginDrain();
+    WaitForDrain();
+}
+
+void DriverAlsa::Pimpl::BeginDrain()
+{
+    if (iDrainPending || iDraining)
+    {
+        return;
+    }
+
+    // A paused PCM would never drain.
+    Resume();
+
+    if (iWriter != nullptr)
+    {
+        // The writer plays out what the ring holds now, however little,
+        // then drains the PCM.
+        AutoMutex _(iWriterLock);
+
+        iDrainBytes   = iRing.Bytes();
+        iDrainPending = true;
+        WakeWriter();
+
+        return;
+    }
+
+    FlushPending();
+    snd_pcm_nonblock(iHandle, 1);
+    StartDrain();
+}
+
+void DriverAlsa::Pimpl::StartDrain()
+{
+    // Non-blocking, the drain is started and left to run.
+    auto err = snd_pcm_drain(iHandle);
+    if (err < 0 && err != -EAGAIN)
+    {
+        Log::Print("DriverAlsa: snd_pcm_drain() error : %s\n",
+                   snd_strerror(err));
+        ASSERTS();
+    }
+
+    // Only the device's buffer is left to play, so the timeout runs from
+    // here.
+    iDrainStart = std::chrono::steady_clock::now();
+    iDraining   = true;
+}
+
+TBool DriverAlsa::Pimpl::PollDrain(TUint aWaitMs)
+{
+    {
+        AutoMutex _(iWriterLock);
+
+        // Finished, or cut short by a discard.
+        if (!iDraining)
+        {
+            return true;
+        }
+
+        // The null plugin drains at once, so play out the simulated DAC.
+        const TBool drained =
+            snd_pcm_state(iHandle) != SND_PCM_STATE_DRAINING &&
+            (!iSink.Active() || iSink.DelayFrames() == 0);
+        const TUint drainUs = MicrosecondsSince(iDrainStart);
+
+        if (drained || drainUs / 1000 >= kDrainTimeoutMs)
+        {
+            if (!drained)
+            {
+                Log::Print("DriverAlsa: Drain timed out, dropping\n");
+                snd_pcm_drop(iHandle);
+            }
+
+            if (iWriter == nullptr)
+            {
+                snd_pcm_nonblock(iHandle, 0);
+            }
+
+            // Ready for the audio queued behind the drain.
+            auto err = snd_pcm_prepare(iHandle);
+            if (err < 0)
+            {
+                Log::Print("DriverAlsa: snd_pcm_prepare() error : %s\n",
+                           snd_strerror(err));
+            }
+
+            iSink.Reset();
+            iDraining = false;
+            iHealth.Drained(drainUs);
+
+            return true;
+        }
+    }
+
+    pollfd*    fds   = &iPollFds[1];
+    const TInt count =
+        snd_pcm_poll_descriptors(iHandle, fds, iPollFds.size() - 1);
+
+    // Not every plugin signals the end of a drain, so look again every so
+    // often regardless.
+    if (count > 0 && !iSink.Active())
+    {
+        poll(fds, count, aWaitMs);
+    }
+    else
+    {
+        usleep(aWaitMs * 1000);
+    }
+
+    return false;
+}
+
+void DriverAlsa::Pimpl::WaitForDrain()
+{
+    if (iWriter != nullptr)
+    {
+        // The writer finishes the drain and signals iRingSpace when it
+        // has.
+        for (;;)
+        {
+            iRingSpace.Clear();
+
+            if (!iDrainPending && !iDraining)
+            {
+                return;
+            }
+
+            iRingSpace.Wait();
+        }
+    }
+
+    while (!PollDrain(kDrainPollMs))
+    {
+    }
+}
+
+void DriverAlsa::Pimpl::CancelDrain()
+{
+    // Called with iWriterLock held, after the PCM has been dropped.
+    if (iDraining && iWriter == nullptr)
+    {
+        snd_pcm_nonblock(iHandle, 0);
+    }
+
+    iDrainPending = false;
+    iDraining     = false;
+    iDrainBytes   = 0;
+}
+
+void DriverAlsa::Pimpl::WriterThread()
+{
+    iRealtime.Apply(eRealtimeWriter);
+
+    while (!iWriterQuit)
+    {
+        if (iDraining)
+        {
+            if (PollDrain(kDrainPollMs))
+            {
+                // Wakes WaitForDrain().
+                iRingSpace.Signal();
+            }
+
+            continue;
+        }
+
+        if (!RingReady())
+        {
+            WaitForWriterWork(false);
+            continue;
+        }
+
+        TBool blocked = false;
+
+        {
+            // Pause() and Resume() use the PCM under the same lock.
+            AutoMutex _(iWriterLock);
+
+            if (iPaused)
+            {
+                continue;
+            }
+
+            TUint        bytes;
+            const TByte* data = iRing.Read(bytes);
+
+            if (iDrainPending)
+            {
+                // Up to the drain point, however little, then drain.
+                bytes = std::min(bytes, iDrainBytes);
+
+                if (bytes == 0)
+                {
+                    StartDrain();
+                    iDrainPending = false;
+                    continue;
+                }
+            }
+            else if (!iRingFlush && bytes > iPeriodBytes)
+            {
+                // Whole periods unless flushing. The ring holds a whole
+                // number of periods, so only a short write can leave less
+                // than one before the wrap, and then that much is written
+                // to realign.
+                bytes -= bytes % iPeriodBytes;
+            }
+
+            auto frames = snd_pcm_writei(iHandle, data, bytes / iSampleBytes);
+
+            if (frames >= 0)
+            {
+                // A partial write leaves the rest for the next pass.
+                if ((TUint)frames < bytes / iSampleBytes)
+                {
+                    iHealth.ShortWrite();
+                }
+
+                iRing.Consume(frames * iSampleBytes);
+                iBytesSent += frames * iSampleBytes;
+                iRingSpace.Signal();
+                SamplePeriod(frames);
+
+                if (iDrainPending)
+                {
+                    iDrainBytes -= frames * iSampleBytes;
+                }
+            }
+            else if (frames == -EAGAIN)
+            {
+                blocked = true;
+            }
+            else if (!Recover(frames))
+            {
+                // Drop what can't be played rather than spin on it.
+                iRing.Consume(bytes);
+                iRingSpace.Signal();
+
+                if (iDrainPending)
+                {
+                    iDrainBytes -= bytes;
+                }
+            }
+        }
+
+        // Paced as the device would have, without holding the animator
+        // off the PCM meanwhile.
+        iSink.Wait();
+
+        if (blocked)
+        {
+            const auto start = std::chrono::steady_clock::now();
+
+            WaitForWriterWork(true);
+
+            iHealth.WriteBlock().Record(MicrosecondsSince(start));
+        }
+    }
+}
+
+TBool DriverAlsa::Pimpl::RingReady() const
+{
+    const TUint bytes = iRing.Bytes();
+    return !iPaused &&
+           (iDrainPending || bytes >= iPeriodBytes ||
+            (iRingFlush && bytes != 0));
+}
+
+void DriverAlsa::Pimpl::WaitForWriterWork(TBool aDevice)
+{
+    TUint count = 1;
+
+    iPollFds[0].fd     = iWakeFd;
+    iPollFds[0].events = POLLIN;
+
+    if (aDevice)
+    {
+        count += snd_pcm_poll_descriptors(iHandle, &iPollFds[1],
+                                          iPollFds.size() - 1);
+    }
+    else
+    {
+        // Ask to be woken by the next commit, then look again in case one
+        // slipped in before the request was seen.
+        iWriterWaiting = true;
+
+        if (RingReady() || iWriterQuit)
+        {
+            iWriterWaiting = false;
+            return;
+        }
+    }
+
+    for (;;)
+    {
+        if (poll(iPollFds.data(), count, -1) < 0)
+        {
+            // EINTR
+            break;
+        }
+
+        if (iPollFds[0].revents & POLLIN)
+        {
+            eventfd_t value;
+            eventfd_read(iWakeFd, &value);
+            break;
+        }
+
+        if (aDevice)
+        {
+            // Plugins such as dmix can report a descriptor ready when the
+            // PCM itself isn't, so ask ALSA what the events mean.
+            unsigned short revents = 0;
+            snd_pcm_poll_descriptors_revents(iHandle, &iPollFds[1],
+                                             count - 1, &revents);
+
+            if (revents & (POLLOUT | POLLERR))
+            {
+                break;
+            }
+        }
+    }
+
+    iWriterWaiting = false;
+}
+
+void DriverAlsa::Pimpl::WakeWriter()
+{
+    eventfd_write(iWakeFd, 1);
+}
+
+TBool DriverAlsa::Pimpl::Recover(TInt aError)
+{
+    if (aError == -EPIPE)
+    {
+        iXruns++;
+        iHealth.Xrun();
+    }
+
+    auto err = snd_pcm_recover(iHandle, aError, 1);
+
+    iHealth.Recovery(err == 0);
+    iSink.Reset();
+
+    if (err < 0)
+    {
+        Log::Print("DriverAlsa: failed to snd_pcm_recover with %s\n",
+                   snd_strerror(err));
+        return false;
+    }
+
+    return true;
+}
+
+void DriverAlsa::Pimpl::SamplePeriod(TUint aFrames)
+{
+    snd_pcm_sframes_t avail;
+    snd_pcm_sframes_t delay;
 
-        if (err < 0)
+    if (iSink.Active())
+    {
+        // The null plugin never runs dry, so an underrun is reported as
+        // ALSA would have, and the simulated DAC starts again.
+        if (iSink.Dry())
         {
-            Log::Print("DriverAlsa: snd_pcm_prepare() error : %s\n",
-                       snd_strerror(err));
-            ASSERTS();
+            Recover(-EPIPE);
         }
+
+        // Reports the simulated DAC's view rather than the null plugin's.
+        iSink.Written(aFrames);
+
+        snd_pcm_uframes_t bufferFrames = 0;
+        snd_pcm_uframes_t periodFrames = 0;
+        snd_pcm_get_params(iHandle, &bufferFrames, &periodFrames);
+
+        delay = iSink.DelayFrames();
+        avail = ((snd_pcm_sframes_t)bufferFrames > delay) ?
+                (snd_pcm_sframes_t)bufferFrames - delay : 0;
+
+        iHealth.Period(avail, delay);
+    }
+    else if (snd_pcm_avail_delay(iHandle, &avail, &delay) == 0)
+    {
+        iHealth.Period(avail, delay);
+    }
+
+    // The first audio after a discard is heard once the PCM starts.
+    LatencyHistogram* toSound = iAwaitingSound;
+
+    if (toSound != nullptr &&
+        snd_pcm_state(iHandle) == SND_PCM_STATE_RUNNING &&
+        iAwaitingSound.compare_exchange_strong(toSound, nullptr))
+    {
+        toSound->Record(MicrosecondsSince(iDiscardTime));
     }
 }
 
 void DriverAlsa::Pimpl::Write(const Brx& aData)
 {
+    // The first period after a drain was converted while it ran, and goes
+    // as soon as it is done.
+    if (iDraining)
+    {
+        WaitForDrain();
+    }
+
+    const snd_pcm_uframes_t frames = aData.Bytes() / iSampleBytes;
+    const auto              start  = std::chrono::steady_clock::now();
     int err;
 
-    err = snd_pcm_writei(iHandle, aData.Ptr(), aData.Bytes() / iSampleBytes);
+    err = snd_pcm_writei(iHandle, aData.Ptr(), frames);
 
     // Handle underrun errors.
     if(err == -EPIPE) {
+        iXruns++;
+        iHealth.Xrun();
         err = snd_pcm_prepare(iHandle);
+        iHealth.Recovery(err == 0);
 
         if (err < 0)
         {
@@ -733,6 +2914,8 @@ void DriverAlsa::Pimpl::Write(const Brx& aData)
     }
 
 
+    iHealth.WriteBlock().Record(MicrosecondsSince(start));
+
     if (err < 0)
     {
         Log::Print("DriverAlsa: snd_pcm_writei() got error %s\n",
@@ -740,7 +2923,14 @@ void DriverAlsa::Pimpl::Write(const Brx& aData)
     }
     else
     {
-        iBytesSent += aData.Bytes();
+        if ((snd_pcm_uframes_t)err < frames)
+        {
+            iHealth.ShortWrite();
+        }
+
+        iBytesSent += err * iSampleBytes;
+        SamplePeriod(err);
+        iSink.Wait();
     }
 }
 
@@ -785,36 +2975,112 @@ void DriverAlsa::Pimpl::LogPCMState()
 
 void DriverAlsa::Pimpl::ProcessDecodedStream(MsgDecodedStream* aMsg)
 {
-    if (iProfileIndex != -1)
+    const auto start = std::chrono::steady_clock::now();
+    auto decodedStreamInfo = aMsg->StreamInfo();
+
+    Log::Print("DriverAlsa: Bytes Sent since last MsgDecodedStream = %u\n",
+               iBytesSent.exchange(0));
+
+    Wake();
+
+    // The same stream again is a seek within it, and a new one while
+    // paused follows a skip or stop. Either way the audio still queued
+    // from before is no longer wanted.
+    if (iConfigured && decodedStreamInfo.StreamId() == iStreamId)
     {
-        // Drain and stop the PCM.
-        auto err = snd_pcm_drain(iHandle);
-        if (err < 0)
-        {
-            Log::Print("DriverAlsa: snd_pcm_drain() error : %s\n",
-                       snd_strerror(err));
-            ASSERTS();
-        }
+        Discard();
+        AwaitSound(iHealth.SeekToSound(), start);
+    }
+    else if (iConfigured && iPaused)
+    {
+        Discard();
+        AwaitSound(iHealth.SkipToSound(), start);
     }
 
-    auto decodedStreamInfo = aMsg->StreamInfo();
+    iStreamId = decodedStreamInfo.StreamId();
+
+    // Playback has been clean for a while, so trim the buffer towards the
+    // target. It takes effect when the device is next configured.
+    if (iConfigured &&
+        start - iStableSince > std::chrono::seconds(kStableSecs) &&
+        iTuner.Shrink())
+    {
+        iStableSince = start;
+    }
+
+    // Kept for next time, whatever the last stream did to it.
+    iTuner.Save();
+
+    // Consecutive tracks of an album usually share a format. Draining and
+    // reconfiguring the device between them would leave a gap of a whole
+    // hardware buffer, so keep the PCM running instead. A pending change
+    // of buffer size is made at the same time.
+    const TBool reconfigure =
+        !iConfigured ||
+        iTuner.BufferUs() != iConfiguredBufferUs ||
+        iLatency.RingUs() != iConfiguredRingUs   ||
+        iResamplerQuality != (TUint)iConfiguredQuality ||
+        decodedStreamInfo.BitDepth()    != iStreamBitDepth   ||
+        decodedStreamInfo.SampleRate()  != iStreamSampleRate ||
+        decodedStreamInfo.NumChannels() != iStreamNumChannels;
+
+    if (reconfigure)
+    {
+        ConfigureStream(decodedStreamInfo.BitDepth(),
+                        decodedStreamInfo.SampleRate(),
+                        decodedStreamInfo.NumChannels());
+    }
+    else
+    {
+        Log::Print("DriverAlsa: Stream format unchanged, PCM left running\n");
+    }
+
+    // Only a Songcast receiver pulls the clock, and it starts the puller
+    // before its first stream reaches us, so look at every stream rather
+    // than just those that change format.
+    if (iClockPuller.Active())
+    {
+        iPcmProcessor.EnableRateAdjust(decodedStreamInfo.NumChannels());
+    }
+    else
+    {
+        iPcmProcessor.DisableRateAdjust();
+    }
+
+    if (iConfigured)
+    {
+        UpdateResampleDelay();
+    }
+
+    const TUint gapUs = MicrosecondsSince(start);
+
+    iStreamStats.Record(reconfigure, gapUs);
+
+    Log::Print("DriverAlsa: Stream change took %u us\n", gapUs);
+}
 
-    Log::Print("DriverAlsa: Bytes Sent since last MsgDecodedStream = %d\n",
-               iBytesSent);
+void DriverAlsa::Pimpl::ConfigureStream(TUint aBitDepth, TUint aSampleRate,
+                                        TUint aNumChannels)
+{
+    // Let the PCM play out what it has while the new stream is got ready.
+    const TBool draining = iConfigured;
 
-    iBytesSent = 0;
+    if (draining)
+    {
+        BeginDrain();
+    }
 
     Log::Print("DriverAlsa: Finding PcmProcessor for stream: BitDepth = %d, "
                "SampleRate = %d, Channels = %d\n",
-               decodedStreamInfo.BitDepth(), decodedStreamInfo.SampleRate(),
-               decodedStreamInfo.NumChannels());
+               aBitDepth, aSampleRate,
+               aNumChannels);
 
     // Mono plays badly on the Raspberry Pi and causes issues when
     // switching to a stereo track.
     //
     // So we configure the playback for stereo and duplicate the
     // channel data.
-    if (decodedStreamInfo.NumChannels() == 1)
+    if (aNumChannels == 1)
     {
         iDuplicateChannel = true;
     }
@@ -823,32 +3089,153 @@ void DriverAlsa::Pimpl::ProcessDecodedStream(MsgDecodedStream* aMsg)
         iDuplicateChannel = false;
     }
 
-    for (TUint i = 0; i < iProfiles.size(); ++i)
+    const Profile* profile = FindProfile(aBitDepth);
+    const TUint    outputChannels =
+        aNumChannels * (iDuplicateChannel ? 2 : 1);
+
+    // Play at the stream's own rate if the device has it. Failing that,
+    // and unless resampling is turned off, at the nearest rate it does
+    // have.
+    const ResamplerQuality quality =
+        (ResamplerQuality)iResamplerQuality.load();
+    const TUint nearest   = iCaps.NearestRate(aSampleRate);
+    TUint       rates[2];
+    TUint       rateCount = 0;
+
+    if (iCaps.SupportsRate(aSampleRate))
+    {
+        rates[rateCount++] = aSampleRate;
+    }
+
+    if (quality != eResamplerOff && nearest != 0 && nearest != aSampleRate &&
+        PolyphaseResampler::Supports(aSampleRate, nearest))
     {
-        if (TryProfile(iProfiles[i], decodedStreamInfo.BitDepth(),
-                       decodedStreamInfo.NumChannels(),
-                       decodedStreamInfo.SampleRate(), iBufferUs))
+        rates[rateCount++] = nearest;
+    }
+
+    if (profile == nullptr || !iCaps.SupportsChannels(outputChannels))
+    {
+        rateCount = 0;
+    }
+
+    iConfiguredQuality = quality;
+
+    // Designing the resampler's filter is the slow part of getting ready,
+    // so do it before waiting for the drain.
+    if (rateCount > 0 && rates[rateCount - 1] != aSampleRate)
+    {
+        iPcmProcessor.PrepareResample(aSampleRate, rates[rateCount - 1],
+                                      quality);
+    }
+
+    if (draining)
+    {
+        WaitForDrain();
+    }
+
+    for (TUint r = 0; r < rateCount; r++)
+    {
+        const TUint deviceRate = rates[r];
+
+        for (TUint i = 0; i < profile->Formats().size(); ++i)
         {
-            iProfileIndex = i;
+            const OutputFormat format = profile->Formats()[i];
+
+            if (!iCaps.SupportsFormat(format.first))
+            {
+                continue;
+            }
+
+            if (!TryFormat(format, aNumChannels,
+                           deviceRate, iTuner.BufferUs()))
+            {
+                continue;
+            }
+
+            iConfigured        = true;
+            iOutputFormat      = format;
+            iConfiguredBufferUs = iTuner.BufferUs();
+            iConfiguredRingUs  = iLatency.RingUs();
+            iStreamBitDepth    = aBitDepth;
+            iStreamSampleRate  = aSampleRate;
+            iStreamNumChannels = aNumChannels;
+
+            iPcmProcessor.Configure(format, iDuplicateChannel);
+
+            if (deviceRate != aSampleRate)
+            {
+                iPcmProcessor.EnableResample(aSampleRate, deviceRate,
+                                             aNumChannels, quality);
+            }
+            else
+            {
+                iPcmProcessor.DisableResample();
+            }
 
-            PcmProcessorBase& pcmP =
-                (PcmProcessorBase&)iProfiles[i].GetPcmProcessor();
-            pcmP.SetDuplicateChannel(iDuplicateChannel);
-            pcmP.SetBitDepth(decodedStreamInfo.BitDepth());
+            iDeviceRate = deviceRate;
+            UpdateResampleDelay();
 
-            iSampleBytes =
-                decodedStreamInfo.NumChannels() *
-                iProfiles[i].GetFormat(decodedStreamInfo.BitDepth()).second;
+            TUint sampleBytes = aNumChannels * format.second;
 
             // If we manually converting mono to stereo the sample size doubles.
             if (iDuplicateChannel)
             {
-                iSampleBytes *= 2;
+                sampleBytes *= 2;
+            }
+
+            iSampleBytes = sampleBytes;
+
+            // Writes are gathered into whole periods of the negotiated
+            // configuration.
+            snd_pcm_uframes_t bufferFrames = 0;
+            snd_pcm_uframes_t periodFrames = 0;
+
+            if (snd_pcm_get_params(iHandle, &bufferFrames, &periodFrames) < 0 ||
+                periodFrames == 0)
+            {
+                periodFrames = 1;
             }
 
+            iPeriodBytes  = periodFrames * iSampleBytes;
+            iPendingBytes = 0;
+            iMmapFrames   = 0;
+
+            iSink.Start(deviceRate, bufferFrames);
+
+            // Reserve conversion space for a period, so that playback
+            // doesn't allocate. mmap and the ring are converted into
+            // directly.
+            const TBool arena = (iWriter == nullptr && !iMmap);
+            iArena.Reserve(arena ? iPeriodBytes.load() : 0);
+
+            if (iRingUs != 0)
+            {
+                // A whole number of periods, and at least two, so the
+                // writer can always take a whole period from the ring.
+                TUint frames = (TUint)
+                    (((TUint64)deviceRate * iLatency.RingUs()) / 1000000);
+                TUint periods = (frames + periodFrames - 1) / periodFrames;
+
+                if (periods < 2)
+                {
+                    periods = 2;
+                }
+
+                iRing.Reset(periods * periodFrames, iSampleBytes);
+            }
+
+            // Everything the driver can hold below the pipeline.
+            iBufferJiffies =
+                (bufferFrames + iRing.Capacity() / iSampleBytes) *
+                Jiffies::PerSample(deviceRate);
+
             iDitch = false;
 
-            Log::Print("Found PcmProcessor %d\n", iProfileIndex);
+            Log::Print("DriverAlsa: Using output format %s, %s access, "
+                       "%u Hz, period %lu frames, buffer %lu frames\n",
+                       snd_pcm_format_name(format.first),
+                       iMmap ? "mmap" : "read/write", deviceRate,
+                       periodFrames, bufferFrames);
 
             return;
         }
@@ -856,19 +3243,58 @@ void DriverAlsa::Pimpl::ProcessDecodedStream(MsgDecodedStream* aMsg)
 
     Log::Print("DriverAlsa: Could not find a PcmProcessor for stream! "
                "BitDepth = %d, SampleRate = %d, Channels = %d\n",
-               decodedStreamInfo.BitDepth(), decodedStreamInfo.SampleRate(),
-               decodedStreamInfo.NumChannels());
+               aBitDepth, aSampleRate,
+               aNumChannels);
 
     iDitch = true;
-    iProfileIndex = -1;
+    iConfigured = false;
+    iBufferJiffies = 0;
+    iDeviceRate = 0;
+    iResampleDelayJiffies = 0;
+    iPcmProcessor.DisableResample();
+}
+
+const ConversionArena& DriverAlsa::Pimpl::Arena() const
+{
+    return iArena;
+}
+
+RealtimePolicy& DriverAlsa::Pimpl::Realtime()
+{
+    return iRealtime;
+}
+
+StreamChangeStats& DriverAlsa::Pimpl::StreamStats()
+{
+    return iStreamStats;
+}
+
+DriverHealth& DriverAlsa::Pimpl::Health()
+{
+    return iHealth;
+}
+
+Mutex& DriverAlsa::Pimpl::AnimatorLock()
+{
+    return iAnimatorLock;
 }
 
-TBool DriverAlsa::Pimpl::TryProfile(Profile& aProfile, TUint aBitDepth,
-                                    TUint aNumChannels, TUint aSampleRate,
-                                    TUint aBufferUs)
+const Profile* DriverAlsa::Pimpl::FindProfile(TUint aBitDepth) const
 {
-    auto outputFormat = aProfile.GetFormat(aBitDepth);
+    for (const Profile& profile : iProfiles)
+    {
+        if (profile.BitDepth() == aBitDepth)
+        {
+            return &profile;
+        }
+    }
+
+    return nullptr;
+}
 
+TBool DriverAlsa::Pimpl::TryFormat(OutputFormat aFormat, TUint aNumChannels,
+                                   TUint aSampleRate, TUint aBufferUs)
+{
     if (iDuplicateChannel)
     {
         // We are manually converting a mono input to stereo.
@@ -876,53 +3302,224 @@ TBool DriverAlsa::Pimpl::TryProfile(Profile& aProfile, TUint aBitDepth,
         aNumChannels *= 2;
     }
 
-    auto err = snd_pcm_set_params(iHandle,
-                                  outputFormat.first,
-                                  SND_PCM_ACCESS_RW_INTERLEAVED,
-                                  aNumChannels,
-                                  aSampleRate,
-                                  0,             // no soft-resample
-                                  aBufferUs);
-    return err == 0;
+    // Converting straight into the mmap area saves a copy and a syscall
+    // per fragment. Not every plugin chain can mmap, so fall back to
+    // snd_pcm_writei() when it can't. The ring writer always uses
+    // snd_pcm_writei().
+    if (iWriter == nullptr && iCaps.SupportsMmap() &&
+        SetParams(aFormat.first, SND_PCM_ACCESS_MMAP_INTERLEAVED,
+                  aNumChannels, aSampleRate, aBufferUs))
+    {
+        iMmap = true;
+        return true;
+    }
+
+    iMmap = false;
+    return SetParams(aFormat.first, SND_PCM_ACCESS_RW_INTERLEAVED,
+                     aNumChannels, aSampleRate, aBufferUs);
 }
 
-TUint DriverAlsa::Pimpl::DriverDelayJiffies(TUint aSampleRate)
+TBool DriverAlsa::Pimpl::SetParams(snd_pcm_format_t aFormat,
+                                   snd_pcm_access_t aAccess,
+                                   TUint aNumChannels, TUint aSampleRate,
+                                   TUint aBufferUs)
 {
-    snd_pcm_sframes_t dp;
-    int ret;
+    snd_pcm_hw_params_t* hwParams;
+    snd_pcm_sw_params_t* swParams;
+    int                  dir = 0;
 
-    if (!aSampleRate) {
-        return 0;
+    snd_pcm_hw_params_alloca(&hwParams);
+    snd_pcm_sw_params_alloca(&swParams);
+
+    // No soft-resample, the rate must be exact.
+    if (snd_pcm_hw_params_any(iHandle, hwParams) < 0 ||
+        snd_pcm_hw_params_set_rate_resample(iHandle, hwParams, 0) < 0 ||
+        snd_pcm_hw_params_set_access(iHandle, hwParams, aAccess) < 0 ||
+        snd_pcm_hw_params_set_format(iHandle, hwParams, aFormat) < 0 ||
+        snd_pcm_hw_params_set_channels(iHandle, hwParams, aNumChannels) < 0 ||
+        snd_pcm_hw_params_set_rate(iHandle, hwParams, aSampleRate, 0) < 0)
+    {
+        return false;
     }
 
-    // Verify the supplied sample rate is supported.
-    snd_pcm_hw_params_t *hwParams;
-    TUint                err;
+    // Size the buffer for the latency wanted and split it into kPeriods,
+    // within what the device allows. Should its periods be too long for
+    // that, make the buffer at least two of them.
+    snd_pcm_uframes_t buffer = iCaps.ClampBuffer(
+        (snd_pcm_uframes_t)(((TUint64)aSampleRate * aBufferUs) / 1000000));
+    snd_pcm_uframes_t period = iCaps.ClampPeriod(buffer / kPeriods);
 
-    snd_pcm_hw_params_alloca(&hwParams);
-    err = snd_pcm_hw_params_any(iHandle, hwParams);
+    buffer = iCaps.ClampBuffer(std::max(buffer, 2 * period));
+
+    if (snd_pcm_hw_params_set_buffer_size_near(iHandle, hwParams,
+                                               &buffer) < 0 ||
+        snd_pcm_hw_params_set_period_size_near(iHandle, hwParams,
+                                               &period, &dir) < 0)
+    {
+        return false;
+    }
+
+    auto err = snd_pcm_hw_params(iHandle, hwParams);
     if (err < 0)
     {
-        Log::Print("DriverAlsa: Cannot get hardware parameters: %s\n",
+        Log::Print("DriverAlsa: snd_pcm_hw_params() error : %s\n",
                    snd_strerror(err));
+        return false;
+    }
 
-        THROW(SampleRateUnsupported);
+    snd_pcm_hw_params_get_buffer_size(hwParams, &buffer);
+    snd_pcm_hw_params_get_period_size(hwParams, &period, &dir);
+
+    iCanPause = (snd_pcm_hw_params_can_pause(hwParams) == 1);
+
+    // Start once the buffer holds all the whole periods it can, as
+    // snd_pcm_set_params() would, and wake writers a period at a time.
+    err = snd_pcm_sw_params_current(iHandle, swParams);
+    if (err == 0)
+    {
+        snd_pcm_sw_params_set_start_threshold(iHandle, swParams,
+                                              (buffer / period) * period);
+        snd_pcm_sw_params_set_avail_min(iHandle, swParams, period);
+
+        // Timestamp status on CLOCK_MONOTONIC so the delay can be brought
+        // up to date in DriverDelayJiffies().
+        snd_pcm_sw_params_set_tstamp_mode(iHandle, swParams,
+                                          SND_PCM_TSTAMP_ENABLE);
+        snd_pcm_sw_params_set_tstamp_type(iHandle, swParams,
+                                          SND_PCM_TSTAMP_TYPE_MONOTONIC);
+        err = snd_pcm_sw_params(iHandle, swParams);
+    }
+
+    if (err < 0)
+    {
+        Log::Print("DriverAlsa: snd_pcm_sw_params() error : %s\n",
+                   snd_strerror(err));
+        return false;
+    }
+
+    return true;
+}
+
+TUint DriverAlsa::Pimpl::MaxBitDepth() const
+{
+    return iMaxBitDepth;
+}
+
+TUint DriverAlsa::Pimpl::MaxSampleRate() const
+{
+    return iMaxSampleRate;
+}
+
+TUint DriverAlsa::Pimpl::DriverDelayJiffies(TUint aSampleRate)
+{
+    if (!aSampleRate) {
+        return 0;
     }
 
-    if (snd_pcm_hw_params_test_rate(iHandle, hwParams, aSampleRate, 0) < 0)
+    // Verify the supplied sample rate is supported, directly or through
+    // the resampler.
+    const TUint nearest = iCaps.NearestRate(aSampleRate);
+
+    if (!iCaps.SupportsRate(aSampleRate) &&
+        (iResamplerQuality == eResamplerOff || nearest == 0 ||
+         !PolyphaseResampler::Supports(aSampleRate, nearest)))
     {
         THROW(SampleRateUnsupported);
     }
 
-    ret = snd_pcm_delay(iHandle, &dp);
-    if (ret < 0) {
-        Log::Print("DriverAlsa: snd_pcm_delay() error : %s\n",
-                   snd_strerror(ret));
+    // The device's frames are at the rate it was opened at, which differs
+    // from the stream's while resampling.
+    const TUint deviceRate = (iDeviceRate != 0) ? (TUint)iDeviceRate :
+                                                  aSampleRate;
+
+    snd_pcm_status_t* status;
+    snd_pcm_status_alloca(&status);
+
+    AutoMutex _(iHandleLock);
+
+    // Closed while idle, nothing is queued.
+    if (iHandle == nullptr)
+    {
+        return 0;
+    }
+
+    // The writer moves audio from the ring to the device under this lock.
+    // Holding it too means the device's delay and the ring's fill are
+    // taken at the same point, so nothing is counted twice or missed.
+    AutoMutex __(iWriterLock);
+
+    if (iSink.Active())
+    {
+        TUint64 frames = iSink.DelayFrames();
+
+        if (iSampleBytes != 0)
+        {
+            frames += (iRing.Bytes() + iPendingBytes) / iSampleBytes;
+        }
+
+        return (TUint)frames * Jiffies::PerSample(deviceRate) +
+               iResampleDelayJiffies;
+    }
+
+    auto err = snd_pcm_status(iHandle, status);
+    if (err < 0) {
+        Log::Print("DriverAlsa: snd_pcm_status() error : %s\n",
+                   snd_strerror(err));
         return 0;
     }
 
-    Log::Print("DriverAlsa: snd_pcm_delay() : %u\n", dp);
-    return dp * Jiffies::PerSample(aSampleRate);
+    TInt64 frames = snd_pcm_status_get_delay(status);
+
+    // The delay was measured when the status was taken. While running the
+    // DAC has played on since then, so bring it up to date.
+    if (snd_pcm_status_get_state(status) == SND_PCM_STATE_RUNNING)
+    {
+        snd_htimestamp_t taken;
+        timespec         now;
+
+        snd_pcm_status_get_htstamp(status, &taken);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        const TInt64 elapsedNs =
+            (TInt64)(now.tv_sec - taken.tv_sec) * 1000000000 +
+            (now.tv_nsec - taken.tv_nsec);
+
+        if (taken.tv_sec != 0 && elapsedNs > 0)
+        {
+            frames -= (elapsedNs * deviceRate) / 1000000000;
+        }
+
+        if (frames < 0)
+        {
+            frames = 0;
+        }
+    }
+
+    // Audio queued in the ring, or gathered towards a period, hasn't
+    // reached the device yet.
+    if (iSampleBytes != 0)
+    {
+        frames += (iRing.Bytes() + iPendingBytes) / iSampleBytes;
+    }
+
+    return (TUint)frames * Jiffies::PerSample(deviceRate) +
+           iResampleDelayJiffies;
+}
+
+void DriverAlsa::Pimpl::UpdateResampleDelay()
+{
+    // The rate converter works in the stream's frames, the rate adjuster
+    // after it in the device's.
+    iResampleDelayJiffies =
+        iPcmProcessor.ResampleDelayFrames() *
+        Jiffies::PerSample(iStreamSampleRate) +
+        iPcmProcessor.RateAdjustDelayFrames() *
+        Jiffies::PerSample(iDeviceRate);
+}
+
+TUint DriverAlsa::Pimpl::BufferJiffies() const
+{
+    return iBufferJiffies;
 }
 
 
@@ -935,14 +3532,26 @@ const TUint DriverAlsa::kSupportedMsgTypes = PipelineElement::MsgType::eMode
 | PipelineElement::MsgType::ePlayable
 | PipelineElement::MsgType::eQuit;
 
-DriverAlsa::DriverAlsa(IPipeline& aPipeline, TUint aBufferUs)
+const TChar* DriverAlsa::kShellCommand = "alsa";
+
+DriverAlsa::DriverAlsa(IPipeline& aPipeline, Shell& aShell,
+                       Configuration::IStoreReadWrite& aStore,
+                       Configuration::IConfigInitialiser& aConfigInit,
+                       ClockPullerAlsa& aClockPuller,
+                       const Brx& aDevice, TUint aBufferUs, TUint aRingUs)
     : PipelineElement(kSupportedMsgTypes)
-    , iPimpl(new Pimpl("default", aBufferUs))
     , iPipeline(aPipeline)
-    , iMutex("alsa")
+    , iShell(aShell)
     , iQuit(false)
+    , iDeviceLock("ALDL")
+    , iDevice(aDevice)
+    , iDeviceChanged(false)
 {
+    iPimpl = new Pimpl(aStore, aConfigInit, aClockPuller, iDevice.PtrZ(),
+                       aBufferUs, aRingUs);
+
     iPipeline.SetAnimator(*this);
+    iShell.AddCommandHandler(kShellCommand, *this);
 
     iThread = new ThreadFunctor("PipelineAnimator",
                                 MakeFunctor(*this, &DriverAlsa::AudioThread),
@@ -952,25 +3561,44 @@ DriverAlsa::DriverAlsa(IPipeline& aPipeline, TUint aBufferUs)
 
 DriverAlsa::~DriverAlsa()
 {
+    iShell.RemoveCommandHandler(kShellCommand);
     delete iThread;
     delete iPimpl;
 }
 
 void DriverAlsa::AudioThread()
 {
+    iPimpl->Realtime().Apply(eRealtimeAnimator);
+
     try
     {
+        LatencyHistogram& pullWait = iPimpl->Health().PullWait();
+
         for (;;)
         {
+            const auto start = std::chrono::steady_clock::now();
             Msg* msg = iPipeline.Pull();
+            pullWait.Record(MicrosecondsSince(start));
+
+            // The PCM is closed when idle from another thread, but not
+            // while a message is being dealt with.
+            AutoMutex _(iPimpl->AnimatorLock());
+
+            // Several changes in quick succession reopen once, for the
+            // last.
+            if (iDeviceChanged.exchange(false))
+            {
+                ApplyDeviceChange();
+            }
+
             msg = msg->Process(*this);
             if (msg != NULL)
             {
                 msg->RemoveRef();
             }
 
-            AutoMutex am(iMutex);
-            if (iQuit)
+            // Only ever set on this thread, by ProcessMsg(MsgQuit*).
+            if (iQuit.load(std::memory_order_relaxed))
                 break;
         }
     }
@@ -979,7 +3607,7 @@ void DriverAlsa::AudioThread()
 
 TUint DriverAlsa::PipelineAnimatorBufferJiffies() const
 {
-	return 0;
+    return iPimpl->BufferJiffies();
 }
 
 TUint DriverAlsa::PipelineAnimatorDelayJiffies(AudioFormat aFormat,
@@ -1000,11 +3628,64 @@ TUint DriverAlsa::PipelineAnimatorDsdBlockSizeWords() const
 
 TUint DriverAlsa::PipelineAnimatorMaxBitDepth() const
 {
-    return 0;
+    return iPimpl->MaxBitDepth();
+}
+
+void DriverAlsa::PipelineAnimatorGetMaxSampleRates(TUint& aPcm,
+                                                   TUint& aDsd) const
+{
+    // 0 leaves the pipeline to assume anything will play, as it must when
+    // the device couldn't be probed. There is no DSD output.
+    aPcm = iPimpl->MaxSampleRate();
+    aDsd = 0;
+}
+
+void DriverAlsa::AlsaDeviceChanged(const Brx& aDevice)
+{
+    {
+        AutoMutex _(iDeviceLock);
+
+        if (aDevice == iDevice)
+        {
+            return;
+        }
+
+        if (aDevice.Bytes() > kMaxDeviceBytes - 1)
+        {
+            Log::Print("DriverAlsa: Device name too long, ignored\n");
+            return;
+        }
+
+        iDevice.Replace(aDevice);
+    }
+
+    // Reopening plays out the old device, which may take a while, so it is
+    // left to the PipelineAnimator rather than done on the config thread.
+    // It switches before the next message, so a halted pipeline moves to
+    // the new device as it starts playing again.
+    iDeviceChanged = true;
+}
+
+void DriverAlsa::ApplyDeviceChange()
+{
+    Bws<kMaxDeviceBytes> device;
+
+    {
+        AutoMutex _(iDeviceLock);
+        device.Replace(iDevice);
+    }
+
+    iPimpl->Reopen(device.PtrZ());
+}
+
+void DriverAlsa::ResamplerQualityChanged(ResamplerQuality aQuality)
+{
+    iPimpl->SetResamplerQuality(aQuality);
 }
 
 Msg* DriverAlsa::ProcessMsg(MsgHalt* aMsg)
 {
+    iPimpl->ProcessHalt();
     aMsg->ReportHalted();
 
     return aMsg;
@@ -1024,23 +3705,76 @@ Msg* DriverAlsa::ProcessMsg(MsgPlayable* aMsg)
 
 Msg* DriverAlsa::ProcessMsg(MsgQuit* aMsg)
 {
-    AutoMutex am(iMutex);
     iQuit = true;
     return aMsg;
 }
 
 Msg* DriverAlsa::ProcessMsg(MsgMode* aMsg)
 {
-    // TODO
+    iPimpl->ProcessMode(aMsg->Mode());
     return aMsg;
 }
 
 Msg* DriverAlsa::ProcessMsg(MsgDrain* aMsg)
 {
-    // Ensure the ALSA audio buffer is emptied.
+    // The ALSA audio buffer empties in the background. Nothing after this
+    // reaches the DAC before it has, and until then what is left is
+    // counted in the delay reported to the pipeline.
     iPimpl->ProcessDrain();
 
     aMsg->ReportDrained();
 
     return aMsg;
 }
+
+void DriverAlsa::HandleShellCommand(Brn aCommand,
+                                    const std::vector<Brn>& aArgs,
+                                    IWriter& aResponse)
+{
+    if (aArgs.size() == 1 && aArgs[0] == Brn("reset"))
+    {
+        iPimpl->Health().Reset();
+        iPimpl->StreamStats().Reset();
+        aResponse.Write(Brn("ALSA driver statistics reset\n"));
+        aResponse.WriteFlush();
+        return;
+    }
+
+    if (aArgs.size() != 1 || aArgs[0] != Brn("stats"))
+    {
+        DisplayHelp(aResponse);
+        return;
+    }
+
+    const ConversionArena& arena = iPimpl->Arena();
+    Bws<128> line;
+
+    line.AppendPrintf("Conversion arena bytes:  %u\n", arena.Bytes());
+    aResponse.Write(line);
+    line.SetBytes(0);
+    line.AppendPrintf("Render path allocations: %u\n",
+                      arena.RenderAllocations());
+    aResponse.Write(line);
+
+    const StreamChangeStats& streams = iPimpl->StreamStats();
+
+    line.SetBytes(0);
+    line.AppendPrintf("Stream changes:          %u (%u reconfigured)\n",
+                      streams.StreamChanges(), streams.Reconfigurations());
+    aResponse.Write(line);
+    line.SetBytes(0);
+    line.AppendPrintf("Stream change gap:       %u us (max %u us)\n",
+                      streams.LastGapUs(), streams.MaxGapUs());
+    aResponse.Write(line);
+
+    iPimpl->Health().Write(aResponse);
+    aResponse.WriteFlush();
+}
+
+void DriverAlsa::DisplayHelp(IWriter& aResponse)
+{
+    aResponse.Write(Brn("alsa stats\n"));
+    aResponse.Write(Brn("  Display ALSA driver statistics\n"));
+    aResponse.Write(Brn("alsa reset\n"));
+    aResponse.Write(Brn("  Reset ALSA driver statistics\n"));
+}
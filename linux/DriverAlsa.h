@@ -2,10 +2,18 @@
 #define HEADER_PIPELINE_DRIVER_ALSA
 
 #include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Configuration/IStore.h>
 #include <OpenHome/Media/Pipeline/Msg.h>
 #include <OpenHome/Media/Utils/ProcessorAudioUtils.h>
+#include <OpenHome/Private/Shell.h>
 #include <OpenHome/Private/Thread.h>
 
+#include <atomic>
+
+#include "AlsaDevice.h"
+#include "ClockPullerAlsa.h"
+#include "PolyphaseResampler.h"
+
 namespace OpenHome {
 namespace Media {
 
@@ -23,11 +31,39 @@ private:
 };
 
 
-class DriverAlsa : public PipelineElement, public IPipelineAnimator, private INonCopyable
+class DriverAlsa : public PipelineElement, public IPipelineAnimator, public IAlsaDeviceObserver, public IResamplerObserver, private IShellCommandHandler, private INonCopyable
 {
     static const TUint kSupportedMsgTypes;
+    static const TChar* kShellCommand;
+    static const TUint kMaxDeviceBytes = 256;
 public:
-    DriverAlsa(IPipeline& aPipeline, TUint aBufferUs);
+    // aDevice is the ALSA PCM to open, or one of the VirtualSink outputs.
+    // Should it fail to open "default" is used instead, and failing that
+    // the null sink. A fallback is logged and shown by "alsa stats".
+    //
+    // aBufferUs is the hardware buffer time to aim for. The buffer grows
+    // from there after underruns and the size reached is kept per device
+    // in aStore.
+    //
+    // aRingUs is the depth of the ring between the PipelineAnimator and the
+    // ALSA writer thread. 0 writes to the device from the animator thread.
+    // A Songcast receiver has its own buffer and ring depth, kept in config
+    // values created through aConfigInit. See ModeLatency.
+    //
+    // aClockPuller, once started by a Songcast receiver, sets the rate
+    // streams are played at.
+    //
+    // The audio threads' real time scheduling, CPUs and memory locking
+    // are config values created through aConfigInit. See RealtimePolicy.
+    //
+    // Once the pipeline has been halted for a while the device is closed,
+    // and reopened as it was when playing starts again. How long, and how
+    // long reopening may take, are config values too. See IdleTimer.
+    DriverAlsa(IPipeline& aPipeline, Shell& aShell,
+               Configuration::IStoreReadWrite& aStore,
+               Configuration::IConfigInitialiser& aConfigInit,
+               ClockPullerAlsa& aClockPuller, const Brx& aDevice,
+               TUint aBufferUs, TUint aRingUs);
     ~DriverAlsa();
 public:
     void AudioThread();
@@ -44,12 +80,25 @@ private: // from IPipelineAnimator
 									   TUint aBitDepth, TUint aNumChannels) const override;
     TUint PipelineAnimatorDsdBlockSizeWords() const override;
     TUint PipelineAnimatorMaxBitDepth() const override;
+    void PipelineAnimatorGetMaxSampleRates(TUint& aPcm, TUint& aDsd) const override;
+public: // from IAlsaDeviceObserver
+    void AlsaDeviceChanged(const Brx& aDevice) override;
+public: // from IResamplerObserver
+    void ResamplerQualityChanged(ResamplerQuality aQuality) override;
+private: // from IShellCommandHandler
+    void HandleShellCommand(Brn aCommand, const std::vector<Brn>& aArgs, IWriter& aResponse) override;
+    void DisplayHelp(IWriter& aResponse) override;
+private:
+    void ApplyDeviceChange();
 private:
     class Pimpl;
     Pimpl* iPimpl;
     IPipeline& iPipeline;
-    Mutex iMutex;
-    TBool iQuit;
+    Shell& iShell;
+    std::atomic<TBool> iQuit;
+    Mutex iDeviceLock;
+    Bws<kMaxDeviceBytes> iDevice;
+    std::atomic<TBool> iDeviceChanged;
     ThreadFunctor *iThread;
 };
 
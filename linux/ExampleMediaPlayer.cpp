@@ -19,6 +19,7 @@
 #include <OpenHome/Private/Shell.h>
 #include <OpenHome/Private/ShellCommandDebug.h>
 
+#include "AlsaDevice.h"
 #include "ConfigGTKKeyStore.h"
 #include "ControlPointProxy.h"
 #include "CustomMessages.h"
@@ -27,6 +28,7 @@
 #include "OpenHomePlayer.h"
 #include "MediaPlayerIF.h"
 #include "OptionalFeatures.h"
+#include "PolyphaseResampler.h"
 #include "RamStore.h"
 
 using namespace OpenHome;
@@ -54,6 +56,9 @@ ExampleMediaPlayer::ExampleMediaPlayer(Net::DvStack& aDvStack,
     , iRxTimestamper(NULL)
     , iTxTsMapper(NULL)
     , iRxTsMapper(NULL)
+    , iClockPuller(NULL)
+    , iAlsaDevice(NULL)
+    , iResampler(NULL)
     , iUserAgent(aUserAgent)
 {
     iShell = new Shell(aDvStack.Env(), kShellPort);
@@ -122,6 +127,13 @@ ExampleMediaPlayer::ExampleMediaPlayer(Net::DvStack& aDvStack,
                                     volumeInit, volumeProfile, *iInfoLogger,
                                     aUdn, mpInit);
 
+    // Output device selection. The driver and mixer both follow it.
+    iAlsaDevice = new ConfigAlsaDevice(iMediaPlayer->ConfigInitialiser());
+    iAlsaDevice->Add(iVolume);
+
+    // Quality of the driver's resampling of rates the device can't play.
+    iResampler = new ConfigResampler(iMediaPlayer->ConfigInitialiser());
+
 #ifdef DEBUG
     iPipelineStateLogger = new LoggingPipelineObserver();
     iMediaPlayer->Pipeline().AddObserver(*iPipelineStateLogger);
@@ -160,6 +172,9 @@ ExampleMediaPlayer::~ExampleMediaPlayer()
 #ifdef DEBUG
     delete iPipelineStateLogger;
 #endif // DEBUG
+    iAlsaDevice->Remove(iVolume);
+    delete iAlsaDevice;
+    delete iResampler;
     delete iMediaPlayer;
     delete iInfoLogger;
     delete iShellDebug;
@@ -189,6 +204,11 @@ void ExampleMediaPlayer::SetSongcastTimestampMappers(
     iRxTsMapper = &aRxTsMapper;
 }
 
+void ExampleMediaPlayer::SetClockPuller(Media::IClockPuller& aClockPuller)
+{
+    iClockPuller = &aClockPuller;
+}
+
 void ExampleMediaPlayer::StopPipeline()
 {
     TUint waitCount = 0;
@@ -255,6 +275,26 @@ PipelineManager& ExampleMediaPlayer::Pipeline()
     return iMediaPlayer->Pipeline();
 }
 
+Shell& ExampleMediaPlayer::DebugShell()
+{
+    return *iShell;
+}
+
+ConfigAlsaDevice& ExampleMediaPlayer::AlsaDevice()
+{
+    return *iAlsaDevice;
+}
+
+ConfigResampler& ExampleMediaPlayer::Resampler()
+{
+    return *iResampler;
+}
+
+IConfigInitialiser& ExampleMediaPlayer::ConfigInitialiser()
+{
+    return iMediaPlayer->ConfigInitialiser();
+}
+
 DvDeviceStandard* ExampleMediaPlayer::Device()
 {
     return iDevice;
@@ -318,7 +358,7 @@ void ExampleMediaPlayer::RegisterPlugins(Environment& aEnv)
 
     iMediaPlayer->Add(SourceFactory::NewReceiver(
                                   *iMediaPlayer,
-                                   Optional<IClockPuller>(nullptr),
+                                   Optional<IClockPuller>(iClockPuller),
                                    Optional<IOhmTimestamper>(iTxTimestamper),
                                    Optional<IOhmTimestamper>(iRxTimestamper),
                                    Optional<IOhmMsgProcessor>(nullptr)));
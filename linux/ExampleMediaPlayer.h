@@ -23,6 +23,9 @@ namespace Net {
     class DvDevice;
 }
 namespace Media {
+    class ConfigAlsaDevice;
+    class ConfigResampler;
+    class IClockPuller;
     class PipelineManager;
     class DriverSongcastSender;
     class AllocatorInfoLogger;
@@ -30,6 +33,7 @@ namespace Media {
 namespace Configuration {
     class ConfigGTKKeyStore;
     class ConfigManager;
+    class IConfigInitialiser;
 }
 namespace Web {
     class ConfigAppMediaPlayer;
@@ -82,7 +86,12 @@ public:
     virtual void            RunWithSemaphore(Net::CpStack& aCpStack);
     void                    SetSongcastTimestampers(IOhmTimestamper& aTxTimestamper, IOhmTimestamper& aRxTimestamper);
     void                    SetSongcastTimestampMappers(IOhmTimestamper& aTxTsMapper, IOhmTimestamper& aRxTsMapper);
+    void                    SetClockPuller(Media::IClockPuller& aClockPuller);
     Media::PipelineManager &Pipeline();
+    Shell                  &DebugShell();
+    Media::ConfigAlsaDevice &AlsaDevice();
+    Media::ConfigResampler &Resampler();
+    Configuration::IConfigInitialiser &ConfigInitialiser();
     Net::DvDeviceStandard  *Device();
     Net::DvDevice          *UpnpAvDevice();
 private: // from Net::IResourceManager
@@ -121,6 +130,9 @@ private:
     IOhmTimestamper           *iRxTimestamper;
     IOhmTimestamper           *iTxTsMapper;
     IOhmTimestamper           *iRxTsMapper;
+    Media::IClockPuller       *iClockPuller;
+    Media::ConfigAlsaDevice   *iAlsaDevice;
+    Media::ConfigResampler    *iResampler;
     const Brx                 &iUserAgent;
     Web::FileResourceHandlerFactory iFileResourceHandlerFactory;
     Web::ConfigAppMediaPlayer *iConfigApp;
@@ -106,6 +106,7 @@ void InitAndRunMediaPlayer(gpointer args)
     Net::CpStack   *cpStack = NULL;
     Net::DvStack   *dvStack = NULL;
     DriverAlsa     *driver  = NULL;
+    ClockPullerAlsa *clockPuller = NULL;
     Bws<512>        roomStore;
     Bws<512>        nameStore;
     const TChar    *productRoom = room;
@@ -187,16 +188,37 @@ void InitAndRunMediaPlayer(gpointer args)
 
     // Add the audio driver to the pipeline.
     //
-    // The 22052ms value a is a bit of a magic number which get's
-    // things going for the Hifiberry Digi+ card.
+    // The driver aims for a 20ms hardware buffer, within what the device
+    // allows, and deepens it for devices that underrun.
     //
-    // FIXME This should be calculated.
-    driver = new DriverAlsa(g_emp->Pipeline(), 22052);
+    // No ring, so the animator thread writes to the device itself. That
+    // lets it convert straight into the device's mmap area, or a reused
+    // period buffer where mmap isn't supported. A non-zero ring depth puts
+    // a writer thread between the pipeline and the device to absorb jitter
+    // in pulling audio, at the cost of a copy through the ring.
+    //
+    // The Songcast receiver steers the driver's playback rate through the
+    // clock puller to stay locked to the sender.
+    {
+        Bws<256> device;
+        g_emp->AlsaDevice().Device(device);
+
+        clockPuller = new ClockPullerAlsa();
+        g_emp->SetClockPuller(*clockPuller);
+
+        driver = new DriverAlsa(g_emp->Pipeline(), g_emp->DebugShell(),
+                                *configStore, g_emp->ConfigInitialiser(),
+                                *clockPuller, device, 20000, 0);
+    }
     if (driver == NULL)
     {
         goto cleanup;
     }
 
+    // Follow changes to the output device and resampler settings.
+    g_emp->AlsaDevice().Add(*driver);
+    g_emp->Resampler().Add(*driver);
+
     // Create the timeout for update checking.
     if (restarted)
     {
@@ -235,6 +257,8 @@ cleanup:
 
     if (driver != NULL)
     {
+        g_emp->AlsaDevice().Remove(*driver);
+        g_emp->Resampler().Remove(*driver);
         delete driver;
     }
 
@@ -243,6 +267,8 @@ cleanup:
         delete g_emp;
     }
 
+    delete clockPuller;
+
     if (g_lib != NULL)
     {
         delete g_lib;
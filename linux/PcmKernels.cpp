@@ -0,0 +1,375 @@
+#include <OpenHome/Types.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif // __SSE2__
+#elif defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "PcmKernels.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+
+// Shuffle descriptions for the SSSE3, AVX2 and NEON kernels.
+
+const PcmShuffle OpenHome::Media::kPcmShuffles[kPcmMaxSourceBytes][kPcmFormatCount][ePcmChannelMapCount] =
+{
+    {   // U8
+        {   // -> S16_LE
+            { 8, 16, 0x80,  { 0x80, 0x00, 0x80, 0x01, 0x80, 0x02, 0x80, 0x03,
+                              0x80, 0x04, 0x80, 0x05, 0x80, 0x06, 0x80, 0x07 } },
+            { 4, 16, 0x80,  { 0x80, 0x00, 0x80, 0x00, 0x80, 0x01, 0x80, 0x01,
+                              0x80, 0x02, 0x80, 0x02, 0x80, 0x03, 0x80, 0x03 } },
+        },
+        {   // -> S32_LE
+            { 4, 16, 0x80,  { 0x80, 0x80, 0x80, 0x00, 0x80, 0x80, 0x80, 0x01,
+                              0x80, 0x80, 0x80, 0x02, 0x80, 0x80, 0x80, 0x03 } },
+            { 2, 16, 0x80,  { 0x80, 0x80, 0x80, 0x00, 0x80, 0x80, 0x80, 0x00,
+                              0x80, 0x80, 0x80, 0x01, 0x80, 0x80, 0x80, 0x01 } },
+        },
+        {   // -> S24_3LE
+            { 4, 12, 0x80,  { 0x80, 0x80, 0x00, 0x80, 0x80, 0x01, 0x80, 0x80,
+                              0x02, 0x80, 0x80, 0x03, 0x80, 0x80, 0x80, 0x80 } },
+            { 2, 12, 0x80,  { 0x80, 0x80, 0x00, 0x80, 0x80, 0x00, 0x80, 0x80,
+                              0x01, 0x80, 0x80, 0x01, 0x80, 0x80, 0x80, 0x80 } },
+        },
+        {   // -> S24_LE
+            { 4, 16, 0x80,  { 0x80, 0x80, 0x80, 0x00, 0x80, 0x80, 0x80, 0x01,
+                              0x80, 0x80, 0x80, 0x02, 0x80, 0x80, 0x80, 0x03 } },
+            { 2, 16, 0x80,  { 0x80, 0x80, 0x80, 0x00, 0x80, 0x80, 0x80, 0x00,
+                              0x80, 0x80, 0x80, 0x01, 0x80, 0x80, 0x80, 0x01 } },
+        },
+    },
+    {   // S16
+        {   // -> S16_LE
+            { 16, 16, 0x00, { 0x01, 0x00, 0x03, 0x02, 0x05, 0x04, 0x07, 0x06,
+                              0x09, 0x08, 0x0b, 0x0a, 0x0d, 0x0c, 0x0f, 0x0e } },
+            { 8, 16, 0x00,  { 0x01, 0x00, 0x01, 0x00, 0x03, 0x02, 0x03, 0x02,
+                              0x05, 0x04, 0x05, 0x04, 0x07, 0x06, 0x07, 0x06 } },
+        },
+        {   // -> S32_LE
+            { 8, 16, 0x00,  { 0x80, 0x80, 0x01, 0x00, 0x80, 0x80, 0x03, 0x02,
+                              0x80, 0x80, 0x05, 0x04, 0x80, 0x80, 0x07, 0x06 } },
+            { 4, 16, 0x00,  { 0x80, 0x80, 0x01, 0x00, 0x80, 0x80, 0x01, 0x00,
+                              0x80, 0x80, 0x03, 0x02, 0x80, 0x80, 0x03, 0x02 } },
+        },
+        {   // -> S24_3LE
+            { 8, 12, 0x00,  { 0x80, 0x01, 0x00, 0x80, 0x03, 0x02, 0x80, 0x05,
+                              0x04, 0x80, 0x07, 0x06, 0x80, 0x80, 0x80, 0x80 } },
+            { 4, 12, 0x00,  { 0x80, 0x01, 0x00, 0x80, 0x01, 0x00, 0x80, 0x03,
+                              0x02, 0x80, 0x03, 0x02, 0x80, 0x80, 0x80, 0x80 } },
+        },
+        {   // -> S24_LE
+            { 8, 16, 0x00,  { 0x80, 0x80, 0x01, 0x00, 0x80, 0x80, 0x03, 0x02,
+                              0x80, 0x80, 0x05, 0x04, 0x80, 0x80, 0x07, 0x06 } },
+            { 4, 16, 0x00,  { 0x80, 0x80, 0x01, 0x00, 0x80, 0x80, 0x01, 0x00,
+                              0x80, 0x80, 0x03, 0x02, 0x80, 0x80, 0x03, 0x02 } },
+        },
+    },
+    {   // S24
+        {   // -> S16_LE
+            { 12, 8, 0x00,  { 0x01, 0x00, 0x04, 0x03, 0x07, 0x06, 0x0a, 0x09,
+                              0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 } },
+            { 12, 16, 0x00, { 0x01, 0x00, 0x01, 0x00, 0x04, 0x03, 0x04, 0x03,
+                              0x07, 0x06, 0x07, 0x06, 0x0a, 0x09, 0x0a, 0x09 } },
+        },
+        {   // -> S32_LE
+            { 12, 16, 0x00, { 0x80, 0x02, 0x01, 0x00, 0x80, 0x05, 0x04, 0x03,
+                              0x80, 0x08, 0x07, 0x06, 0x80, 0x0b, 0x0a, 0x09 } },
+            { 6, 16, 0x00,  { 0x80, 0x02, 0x01, 0x00, 0x80, 0x02, 0x01, 0x00,
+                              0x80, 0x05, 0x04, 0x03, 0x80, 0x05, 0x04, 0x03 } },
+        },
+        {   // -> S24_3LE
+            { 12, 12, 0x00, { 0x02, 0x01, 0x00, 0x05, 0x04, 0x03, 0x08, 0x07,
+                              0x06, 0x0b, 0x0a, 0x09, 0x80, 0x80, 0x80, 0x80 } },
+            { 6, 12, 0x00,  { 0x02, 0x01, 0x00, 0x02, 0x01, 0x00, 0x05, 0x04,
+                              0x03, 0x05, 0x04, 0x03, 0x80, 0x80, 0x80, 0x80 } },
+        },
+        {   // -> S24_LE
+            { 12, 16, 0x00, { 0x80, 0x02, 0x01, 0x00, 0x80, 0x05, 0x04, 0x03,
+                              0x80, 0x08, 0x07, 0x06, 0x80, 0x0b, 0x0a, 0x09 } },
+            { 6, 16, 0x00,  { 0x80, 0x02, 0x01, 0x00, 0x80, 0x02, 0x01, 0x00,
+                              0x80, 0x05, 0x04, 0x03, 0x80, 0x05, 0x04, 0x03 } },
+        },
+    },
+    {   // S32
+        {   // -> S16_LE
+            { 16, 8, 0x00,  { 0x01, 0x00, 0x05, 0x04, 0x09, 0x08, 0x0d, 0x0c,
+                              0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 } },
+            { 16, 16, 0x00, { 0x01, 0x00, 0x01, 0x00, 0x05, 0x04, 0x05, 0x04,
+                              0x09, 0x08, 0x09, 0x08, 0x0d, 0x0c, 0x0d, 0x0c } },
+        },
+        {   // -> S32_LE
+            { 16, 16, 0x00, { 0x03, 0x02, 0x01, 0x00, 0x07, 0x06, 0x05, 0x04,
+                              0x0b, 0x0a, 0x09, 0x08, 0x0f, 0x0e, 0x0d, 0x0c } },
+            { 8, 16, 0x00,  { 0x03, 0x02, 0x01, 0x00, 0x03, 0x02, 0x01, 0x00,
+                              0x07, 0x06, 0x05, 0x04, 0x07, 0x06, 0x05, 0x04 } },
+        },
+        {   // -> S24_3LE
+            { 16, 12, 0x00, { 0x02, 0x01, 0x00, 0x06, 0x05, 0x04, 0x0a, 0x09,
+                              0x08, 0x0e, 0x0d, 0x0c, 0x80, 0x80, 0x80, 0x80 } },
+            { 8, 12, 0x00,  { 0x02, 0x01, 0x00, 0x02, 0x01, 0x00, 0x06, 0x05,
+                              0x04, 0x06, 0x05, 0x04, 0x80, 0x80, 0x80, 0x80 } },
+        },
+        {   // -> S24_LE
+            { 16, 16, 0x00, { 0x03, 0x02, 0x01, 0x00, 0x07, 0x06, 0x05, 0x04,
+                              0x0b, 0x0a, 0x09, 0x08, 0x0f, 0x0e, 0x0d, 0x0c } },
+            { 8, 16, 0x00,  { 0x03, 0x02, 0x01, 0x00, 0x03, 0x02, 0x01, 0x00,
+                              0x07, 0x06, 0x05, 0x04, 0x07, 0x06, 0x05, 0x04 } },
+        },
+    },
+};
+
+
+// SSE2 kernels
+//
+// SSE2 has no byte shuffle, so only the conversions that reduce to 16 bit
+// lane operations are provided. The others stay scalar.
+
+#ifdef __SSE2__
+
+static inline __m128i Swap16(__m128i aV)
+{
+    return _mm_or_si128(_mm_slli_epi16(aV, 8), _mm_srli_epi16(aV, 8));
+}
+
+static inline __m128i Swap32(__m128i aV)
+{
+    aV = _mm_shufflelo_epi16(aV, _MM_SHUFFLE(2, 3, 0, 1));
+    aV = _mm_shufflehi_epi16(aV, _MM_SHUFFLE(2, 3, 0, 1));
+    return Swap16(aV);
+}
+
+template <PcmChannelMap kMap>
+static void Sse2Convert8To16(const TByte* aSrc, TByte* aDst, TUint aSubsamples)
+{
+    const __m128i flip = _mm_set1_epi8((char)0x80);
+    const __m128i zero = _mm_setzero_si128();
+    TUint i = 0;
+
+    for (; i + 16 <= aSubsamples; i += 16)
+    {
+        __m128i v  = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(aSrc + i)), flip);
+        __m128i lo = _mm_unpacklo_epi8(zero, v);
+        __m128i hi = _mm_unpackhi_epi8(zero, v);
+
+        if (kMap == ePcmMonoToStereo)
+        {
+            _mm_storeu_si128((__m128i*)(aDst +  0), _mm_unpacklo_epi16(lo, lo));
+            _mm_storeu_si128((__m128i*)(aDst + 16), _mm_unpackhi_epi16(lo, lo));
+            _mm_storeu_si128((__m128i*)(aDst + 32), _mm_unpacklo_epi16(hi, hi));
+            _mm_storeu_si128((__m128i*)(aDst + 48), _mm_unpackhi_epi16(hi, hi));
+            aDst += 64;
+        }
+        else
+        {
+            _mm_storeu_si128((__m128i*)(aDst +  0), lo);
+            _mm_storeu_si128((__m128i*)(aDst + 16), hi);
+            aDst += 32;
+        }
+    }
+
+    PcmConverter<1, SND_PCM_FORMAT_S16_LE, kMap>::Convert(aSrc + i, aDst,
+                                                          aSubsamples - i);
+}
+
+template <PcmChannelMap kMap>
+static void Sse2Convert16To16(const TByte* aSrc, TByte* aDst, TUint aSubsamples)
+{
+    TUint i = 0;
+
+    for (; i + 8 <= aSubsamples; i += 8)
+    {
+        __m128i v = Swap16(_mm_loadu_si128((const __m128i*)(aSrc + i * 2)));
+
+        if (kMap == ePcmMonoToStereo)
+        {
+            _mm_storeu_si128((__m128i*)(aDst +  0), _mm_unpacklo_epi16(v, v));
+            _mm_storeu_si128((__m128i*)(aDst + 16), _mm_unpackhi_epi16(v, v));
+            aDst += 32;
+        }
+        else
+        {
+            _mm_storeu_si128((__m128i*)aDst, v);
+            aDst += 16;
+        }
+    }
+
+    PcmConverter<2, SND_PCM_FORMAT_S16_LE, kMap>::Convert(aSrc + i * 2, aDst,
+                                                          aSubsamples - i);
+}
+
+template <PcmChannelMap kMap>
+static void Sse2Convert32To16(const TByte* aSrc, TByte* aDst, TUint aSubsamples)
+{
+    TUint i = 0;
+
+    for (; i + 4 <= aSubsamples; i += 4)
+    {
+        // Byte swap each 16 bit lane, then gather the most significant
+        // lane of every sample into the low 64 bits.
+        __m128i v = Swap16(_mm_loadu_si128((const __m128i*)(aSrc + i * 4)));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 1, 2, 0));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 1, 2, 0));
+        v = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 1, 2, 0));
+
+        if (kMap == ePcmMonoToStereo)
+        {
+            _mm_storeu_si128((__m128i*)aDst, _mm_unpacklo_epi16(v, v));
+            aDst += 16;
+        }
+        else
+        {
+            _mm_storel_epi64((__m128i*)aDst, v);
+            aDst += 8;
+        }
+    }
+
+    PcmConverter<4, SND_PCM_FORMAT_S16_LE, kMap>::Convert(aSrc + i * 4, aDst,
+                                                          aSubsamples - i);
+}
+
+template <PcmChannelMap kMap>
+static void Sse2Convert32To32(const TByte* aSrc, TByte* aDst, TUint aSubsamples)
+{
+    TUint i = 0;
+
+    for (; i + 4 <= aSubsamples; i += 4)
+    {
+        __m128i v = Swap32(_mm_loadu_si128((const __m128i*)(aSrc + i * 4)));
+
+        if (kMap == ePcmMonoToStereo)
+        {
+            _mm_storeu_si128((__m128i*)(aDst +  0), _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128((__m128i*)(aDst + 16), _mm_unpackhi_epi32(v, v));
+            aDst += 32;
+        }
+        else
+        {
+            _mm_storeu_si128((__m128i*)aDst, v);
+            aDst += 16;
+        }
+    }
+
+    PcmConverter<4, SND_PCM_FORMAT_S32_LE, kMap>::Convert(aSrc + i * 4, aDst,
+                                                          aSubsamples - i);
+}
+
+TBool OpenHome::Media::PcmKernelsSse2(PcmKernelTable& aTable)
+{
+    const TUint s16 = PcmFormatIndex(SND_PCM_FORMAT_S16_LE);
+    const TUint s32 = PcmFormatIndex(SND_PCM_FORMAT_S32_LE);
+
+    aTable[0][s16][ePcmInterleaved]  = Sse2Convert8To16<ePcmInterleaved>;
+    aTable[0][s16][ePcmMonoToStereo] = Sse2Convert8To16<ePcmMonoToStereo>;
+    aTable[1][s16][ePcmInterleaved]  = Sse2Convert16To16<ePcmInterleaved>;
+    aTable[1][s16][ePcmMonoToStereo] = Sse2Convert16To16<ePcmMonoToStereo>;
+    aTable[3][s16][ePcmInterleaved]  = Sse2Convert32To16<ePcmInterleaved>;
+    aTable[3][s16][ePcmMonoToStereo] = Sse2Convert32To16<ePcmMonoToStereo>;
+    aTable[3][s32][ePcmInterleaved]  = Sse2Convert32To32<ePcmInterleaved>;
+    aTable[3][s32][ePcmMonoToStereo] = Sse2Convert32To32<ePcmMonoToStereo>;
+
+    return true;
+}
+
+#else // __SSE2__
+
+TBool OpenHome::Media::PcmKernelsSse2(PcmKernelTable& /*aTable*/)
+{
+    return false;
+}
+
+#endif // __SSE2__
+
+
+// PcmScalarKernel
+
+namespace {
+
+struct PcmScalarTable
+{
+    PcmScalarTable()
+    {
+        PcmKernelFiller<PcmScalar, 0, 0>::Fill(iKernels);
+    }
+
+    PcmKernelTable iKernels;
+};
+
+} // namespace
+
+PcmKernel OpenHome::Media::PcmScalarKernel(TUint aSource, TUint aFormat,
+                                           TUint aMap)
+{
+    static const PcmScalarTable table;
+    return table.iKernels[aSource][aFormat][aMap];
+}
+
+
+// PcmKernels
+
+const PcmKernels& PcmKernels::Instance()
+{
+    static PcmKernels kernels;
+    return kernels;
+}
+
+PcmKernels::PcmKernels()
+: iName("scalar")
+{
+    PcmKernelFiller<PcmScalar, 0, 0>::Fill(iKernels);
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("sse2") && PcmKernelsSse2(iKernels))
+    {
+        iName = "sse2";
+    }
+
+    if (__builtin_cpu_supports("ssse3") && PcmKernelsSsse3(iKernels))
+    {
+        iName = "ssse3";
+    }
+
+    if (__builtin_cpu_supports("avx2") && PcmKernelsAvx2(iKernels))
+    {
+        iName = "avx2";
+    }
+#elif defined(__aarch64__)
+    // NEON is mandatory on ARMv8.
+    if (PcmKernelsNeon(iKernels))
+    {
+        iName = "neon";
+    }
+#elif defined(__arm__)
+    if ((getauxval(AT_HWCAP) & HWCAP_NEON) && PcmKernelsNeon(iKernels))
+    {
+        iName = "neon";
+    }
+#endif
+}
+
+PcmKernel PcmKernels::Kernel(TUint aSourceBytes, snd_pcm_format_t aFormat,
+                             PcmChannelMap aMap) const
+{
+    const TUint format = PcmFormatIndex(aFormat);
+
+    if (aSourceBytes < 1 || aSourceBytes > kPcmMaxSourceBytes ||
+        format == kPcmFormatCount)
+    {
+        return nullptr;
+    }
+
+    return iKernels[aSourceBytes - 1][format][aMap];
+}
+
+const TChar* PcmKernels::Name() const
+{
+    return iName;
+}
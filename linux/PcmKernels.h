@@ -0,0 +1,275 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+
+#include <alsa/asoundlib.h>
+
+namespace OpenHome {
+namespace Media {
+
+// PCM format conversion kernels for the ALSA output path.
+//
+// Pipeline PCM is big endian. A kernel converts aSubsamples subsamples at
+// aSrc into the little endian ALSA layout at aDst. The mono to stereo
+// variant of each kernel writes every output subsample twice.
+//
+// Vectorised kernels are selected once, on first use, from the instruction
+// set extensions the CPU reports. All variants are bit exact with the
+// scalar PcmConverter instantiations.
+
+typedef void (*PcmKernel)(const TByte* aSrc, TByte* aDst, TUint aSubsamples);
+
+enum PcmChannelMap
+{
+    ePcmInterleaved,
+    ePcmMonoToStereo,
+    ePcmChannelMapCount
+};
+
+// Output formats the kernels can produce, in table order.
+static constexpr snd_pcm_format_t kPcmFormats[] =
+{
+    SND_PCM_FORMAT_S16_LE,
+    SND_PCM_FORMAT_S32_LE,
+    SND_PCM_FORMAT_S24_3LE,
+    SND_PCM_FORMAT_S24_LE,
+};
+
+static const TUint kPcmFormatCount = sizeof(kPcmFormats) / sizeof(kPcmFormats[0]);
+static const TUint kPcmMaxSourceBytes = 4;
+
+// Table index of aFormat, or kPcmFormatCount if it isn't supported.
+constexpr TUint PcmFormatIndex(snd_pcm_format_t aFormat, TUint aIndex = 0)
+{
+    return (aIndex == kPcmFormatCount || kPcmFormats[aIndex] == aFormat) ?
+               aIndex : PcmFormatIndex(aFormat, aIndex + 1);
+}
+
+// Kernels, indexed by source subsample bytes - 1, output format index and
+// channel mapping.
+typedef PcmKernel PcmKernelTable[kPcmMaxSourceBytes][kPcmFormatCount][ePcmChannelMapCount];
+
+class PcmKernels
+{
+public:
+    static const PcmKernels& Instance();
+public:
+    // Returns nullptr if aFormat isn't one of kPcmFormats.
+    PcmKernel Kernel(TUint aSourceBytes, snd_pcm_format_t aFormat,
+                     PcmChannelMap aMap) const;
+    const TChar* Name() const;
+private:
+    PcmKernels();
+private:
+    PcmKernelTable iKernels;
+    const TChar*   iName;
+};
+
+
+// PcmConverter
+//
+// Scalar kernels, specialised at compile time on the source subsample width,
+// the ALSA output format and the channel mapping, so that the inner loop has
+// no branches.
+//
+// Each source subsample is widened to a left justified 32 bit value, then
+// the most significant bytes the output format holds are stored.
+
+template <TUint kSourceBytes> struct PcmSource;
+
+template <> struct PcmSource<1>
+{
+    static TUint32 Read(const TByte* aSrc)
+    {
+        // U8 is offset binary.
+        return (TUint32)(aSrc[0] ^ 0x80) << 24;
+    }
+};
+
+template <> struct PcmSource<2>
+{
+    static TUint32 Read(const TByte* aSrc)
+    {
+        return ((TUint32)aSrc[0] << 24) | ((TUint32)aSrc[1] << 16);
+    }
+};
+
+template <> struct PcmSource<3>
+{
+    static TUint32 Read(const TByte* aSrc)
+    {
+        return ((TUint32)aSrc[0] << 24) | ((TUint32)aSrc[1] << 16) |
+               ((TUint32)aSrc[2] << 8);
+    }
+};
+
+template <> struct PcmSource<4>
+{
+    static TUint32 Read(const TByte* aSrc)
+    {
+        return ((TUint32)aSrc[0] << 24) | ((TUint32)aSrc[1] << 16) |
+               ((TUint32)aSrc[2] << 8)  |  (TUint32)aSrc[3];
+    }
+};
+
+template <snd_pcm_format_t kFormat> struct PcmOutput;
+
+template <> struct PcmOutput<SND_PCM_FORMAT_S16_LE>
+{
+    static const TUint kBytes = 2;
+
+    static void Write(TUint32 aSample, TByte* aDst)
+    {
+        aDst[0] = (TByte)(aSample >> 16);
+        aDst[1] = (TByte)(aSample >> 24);
+    }
+};
+
+template <> struct PcmOutput<SND_PCM_FORMAT_S32_LE>
+{
+    static const TUint kBytes = 4;
+
+    static void Write(TUint32 aSample, TByte* aDst)
+    {
+        aDst[0] = (TByte)(aSample);
+        aDst[1] = (TByte)(aSample >> 8);
+        aDst[2] = (TByte)(aSample >> 16);
+        aDst[3] = (TByte)(aSample >> 24);
+    }
+};
+
+template <> struct PcmOutput<SND_PCM_FORMAT_S24_3LE>
+{
+    static const TUint kBytes = 3;
+
+    static void Write(TUint32 aSample, TByte* aDst)
+    {
+        aDst[0] = (TByte)(aSample >> 8);
+        aDst[1] = (TByte)(aSample >> 16);
+        aDst[2] = (TByte)(aSample >> 24);
+    }
+};
+
+template <> struct PcmOutput<SND_PCM_FORMAT_S24_LE>
+{
+    static const TUint kBytes = 4;
+
+    // The sample sits in the low three bytes, sign extended into the top one.
+    static void Write(TUint32 aSample, TByte* aDst)
+    {
+        aDst[0] = (TByte)(aSample >> 8);
+        aDst[1] = (TByte)(aSample >> 16);
+        aDst[2] = (TByte)(aSample >> 24);
+        aDst[3] = (aSample & 0x80000000) ? 0xff : 0x00;
+    }
+};
+
+template <TUint kSourceBytes, snd_pcm_format_t kFormat, PcmChannelMap kMap>
+struct PcmConverter
+{
+    static void Convert(const TByte* aSrc, TByte* aDst, TUint aSubsamples)
+    {
+        typedef PcmOutput<kFormat> Output;
+
+        for (TUint i = 0; i < aSubsamples; i++)
+        {
+            const TUint32 sample = PcmSource<kSourceBytes>::Read(aSrc);
+
+            Output::Write(sample, aDst);
+            aDst += Output::kBytes;
+
+            if (kMap == ePcmMonoToStereo)
+            {
+                Output::Write(sample, aDst);
+                aDst += Output::kBytes;
+            }
+
+            aSrc += kSourceBytes;
+        }
+    }
+};
+
+
+// Support for the instruction set specific kernels.
+//
+// Every conversion is a byte shuffle. Each step loads 16 source bytes,
+// xors them with iFlip, permutes them through iMask (0x80 selects zero) and
+// stores iOutBytes (8, 12 or 16) bytes, advancing the source by iInBytes.
+//
+// S24_LE can't be produced by a shuffle alone, as its top byte is a sign
+// extension. Its masks build the left justified S32_LE layout, which is
+// then shifted right arithmetically by PcmShuffleShift() bits per 32 bit lane.
+//
+// Kernels are written as Kernel<source index, format index, map>::Convert
+// so that PcmKernelFiller can instantiate the whole matrix of them.
+
+struct PcmShuffle
+{
+    TUint iInBytes;
+    TUint iOutBytes;
+    TByte iFlip;
+    TByte iMask[16];
+};
+
+extern const PcmShuffle kPcmShuffles[kPcmMaxSourceBytes][kPcmFormatCount][ePcmChannelMapCount];
+
+constexpr TUint PcmShuffleShift(TUint aFormat)
+{
+    return (kPcmFormats[aFormat] == SND_PCM_FORMAT_S24_LE) ? 8 : 0;
+}
+
+template <TUint kSource, TUint kFormat, TUint kMap>
+struct PcmScalar
+{
+    static void Convert(const TByte* aSrc, TByte* aDst, TUint aSubsamples)
+    {
+        PcmConverter<kSource + 1, kPcmFormats[kFormat], (PcmChannelMap)kMap>::
+            Convert(aSrc, aDst, aSubsamples);
+    }
+};
+
+template <template <TUint, TUint, TUint> class Kernel, TUint kSource, TUint kFormat>
+struct PcmKernelFiller
+{
+    static void Fill(PcmKernelTable& aTable)
+    {
+        aTable[kSource][kFormat][ePcmInterleaved] =
+            Kernel<kSource, kFormat, ePcmInterleaved>::Convert;
+        aTable[kSource][kFormat][ePcmMonoToStereo] =
+            Kernel<kSource, kFormat, ePcmMonoToStereo>::Convert;
+
+        PcmKernelFiller<Kernel, kSource, kFormat + 1>::Fill(aTable);
+    }
+};
+
+template <template <TUint, TUint, TUint> class Kernel, TUint kSource>
+struct PcmKernelFiller<Kernel, kSource, kPcmFormatCount>
+{
+    static void Fill(PcmKernelTable& aTable)
+    {
+        PcmKernelFiller<Kernel, kSource + 1, 0>::Fill(aTable);
+    }
+};
+
+template <template <TUint, TUint, TUint> class Kernel>
+struct PcmKernelFiller<Kernel, kPcmMaxSourceBytes, 0>
+{
+    static void Fill(PcmKernelTable& /*aTable*/)
+    {
+    }
+};
+
+// Each of these overwrites the entries of aTable it has a faster version of.
+// They return false when the extension isn't available to this build.
+TBool PcmKernelsSse2(PcmKernelTable& aTable);
+TBool PcmKernelsSsse3(PcmKernelTable& aTable);
+TBool PcmKernelsAvx2(PcmKernelTable& aTable);
+TBool PcmKernelsNeon(PcmKernelTable& aTable);
+
+// The scalar kernel for a table entry. The instruction set specific kernels
+// call this for their tails, rather than instantiating PcmScalar under their
+// compiler flags, where the linker could pick that copy for everyone.
+PcmKernel PcmScalarKernel(TUint aSource, TUint aFormat, TUint aMap);
+
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,106 @@
+#include <OpenHome/Types.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif // __AVX2__
+
+#include "PcmKernels.h"
+
+#include <string.h>
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// AVX2 kernels
+//
+// Built with -mavx2 and only selected when the CPU reports AVX2.
+//
+// VPSHUFB shuffles within each 128 bit lane, so every step loads two
+// consecutive source blocks, one per lane, and applies the SSSE3 mask to
+// both.
+
+#ifdef __AVX2__
+
+namespace {
+
+static inline void Avx2StoreLane12(__m128i aV, TByte* aDst)
+{
+    const TUint32 word = (TUint32)_mm_cvtsi128_si32(_mm_srli_si128(aV, 8));
+    _mm_storel_epi64((__m128i*)aDst, aV);
+    memcpy(aDst + 8, &word, sizeof(word));
+}
+
+template <TUint kSource, TUint kFormat, TUint kMap>
+struct Avx2Shuffle
+{
+    static void Convert(const TByte* aSrc, TByte* aDst, TUint aSubsamples);
+};
+
+template <TUint kSource, TUint kFormat, TUint kMap>
+void Avx2Shuffle<kSource, kFormat, kMap>::Convert(const TByte* aSrc,
+                                                  TByte* aDst,
+                                                  TUint aSubsamples)
+{
+    const PcmShuffle& shuffle = kPcmShuffles[kSource][kFormat][kMap];
+    const __m128i mask128 = _mm_loadu_si128((const __m128i*)shuffle.iMask);
+    const __m256i mask    = _mm256_broadcastsi128_si256(mask128);
+    const __m256i flip    = _mm256_set1_epi8((char)shuffle.iFlip);
+    constexpr TUint shift   = PcmShuffleShift(kFormat);
+    const TUint   bytes   = aSubsamples * (kSource + 1);
+    const TUint   step    = shuffle.iInBytes * 2;
+    TUint i = 0;
+
+    // Each lane loads a full 16 bytes, even if it consumes less of them.
+    for (; i + shuffle.iInBytes + 16 <= bytes; i += step)
+    {
+        __m256i v = _mm256_castsi128_si256(
+                        _mm_loadu_si128((const __m128i*)(aSrc + i)));
+        v = _mm256_inserti128_si256(v,
+                _mm_loadu_si128((const __m128i*)(aSrc + i + shuffle.iInBytes)),
+                1);
+        v = _mm256_shuffle_epi8(_mm256_xor_si256(v, flip), mask);
+
+        if (shift != 0)
+        {
+            v = _mm256_srai_epi32(v, shift);
+        }
+
+        if (shuffle.iOutBytes == 16)
+        {
+            _mm256_storeu_si256((__m256i*)aDst, v);
+        }
+        else if (shuffle.iOutBytes == 12)
+        {
+            Avx2StoreLane12(_mm256_castsi256_si128(v), aDst);
+            Avx2StoreLane12(_mm256_extracti128_si256(v, 1), aDst + 12);
+        }
+        else
+        {
+            // Gather the low 64 bits of each lane.
+            v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128((__m128i*)aDst, _mm256_castsi256_si128(v));
+        }
+
+        aDst += shuffle.iOutBytes * 2;
+    }
+
+    PcmScalarKernel(kSource, kFormat, kMap)(aSrc + i, aDst,
+                                            (bytes - i) / (kSource + 1));
+}
+
+} // namespace
+
+TBool OpenHome::Media::PcmKernelsAvx2(PcmKernelTable& aTable)
+{
+    PcmKernelFiller<Avx2Shuffle, 0, 0>::Fill(aTable);
+    return true;
+}
+
+#else // __AVX2__
+
+TBool OpenHome::Media::PcmKernelsAvx2(PcmKernelTable& /*aTable*/)
+{
+    return false;
+}
+
+#endif // __AVX2__
@@ -0,0 +1,102 @@
+#include <OpenHome/Types.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif // __ARM_NEON
+
+#include "PcmKernels.h"
+
+#include <string.h>
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// NEON kernels
+//
+// Built with -mfpu=neon on 32 bit ARM, where they are only selected when
+// the kernel reports NEON support. NEON is always present on AArch64.
+//
+// Table lookups return zero for out of range indices, which covers the
+// 0x80 entries of the shuffle masks.
+
+#ifdef __ARM_NEON
+
+namespace {
+
+template <TUint kSource, TUint kFormat, TUint kMap>
+struct NeonShuffle
+{
+    static void Convert(const TByte* aSrc, TByte* aDst, TUint aSubsamples);
+};
+
+template <TUint kSource, TUint kFormat, TUint kMap>
+void NeonShuffle<kSource, kFormat, kMap>::Convert(const TByte* aSrc,
+                                                  TByte* aDst,
+                                                  TUint aSubsamples)
+{
+    const PcmShuffle& shuffle = kPcmShuffles[kSource][kFormat][kMap];
+    const uint8x16_t  mask  = vld1q_u8(shuffle.iMask);
+    const uint8x16_t  flip  = vdupq_n_u8(shuffle.iFlip);
+    constexpr TUint   shift = PcmShuffleShift(kFormat);
+    const TUint       bytes = aSubsamples * (kSource + 1);
+    TUint i = 0;
+
+    // Each step loads a full vector, even if it consumes less of it.
+    for (; i + 16 <= bytes; i += shuffle.iInBytes)
+    {
+        const uint8x16_t v = veorq_u8(vld1q_u8(aSrc + i), flip);
+
+#ifdef __aarch64__
+        uint8x16_t out = vqtbl1q_u8(v, mask);
+#else // __aarch64__
+        uint8x8x2_t table;
+        table.val[0] = vget_low_u8(v);
+        table.val[1] = vget_high_u8(v);
+        uint8x16_t out = vcombine_u8(vtbl2_u8(table, vget_low_u8(mask)),
+                                     vtbl2_u8(table, vget_high_u8(mask)));
+#endif // __aarch64__
+
+        if (shift != 0)
+        {
+            // VSHL by a negative amount is an arithmetic right shift.
+            out = vreinterpretq_u8_s32(
+                      vshlq_s32(vreinterpretq_s32_u8(out),
+                                vdupq_n_s32(-(TInt)shift)));
+        }
+
+        vst1_u8(aDst, vget_low_u8(out));
+
+        if (shuffle.iOutBytes == 16)
+        {
+            vst1_u8(aDst + 8, vget_high_u8(out));
+        }
+        else if (shuffle.iOutBytes == 12)
+        {
+            const TUint32 word =
+                vget_lane_u32(vreinterpret_u32_u8(vget_high_u8(out)), 0);
+            memcpy(aDst + 8, &word, sizeof(word));
+        }
+
+        aDst += shuffle.iOutBytes;
+    }
+
+    PcmScalarKernel(kSource, kFormat, kMap)(aSrc + i, aDst,
+                                            (bytes - i) / (kSource + 1));
+}
+
+} // namespace
+
+TBool OpenHome::Media::PcmKernelsNeon(PcmKernelTable& aTable)
+{
+    PcmKernelFiller<NeonShuffle, 0, 0>::Fill(aTable);
+    return true;
+}
+
+#else // __ARM_NEON
+
+TBool OpenHome::Media::PcmKernelsNeon(PcmKernelTable& /*aTable*/)
+{
+    return false;
+}
+
+#endif // __ARM_NEON
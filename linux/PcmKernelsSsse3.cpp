@@ -0,0 +1,91 @@
+#include <OpenHome/Types.h>
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif // __SSSE3__
+
+#include "PcmKernels.h"
+
+#include <string.h>
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// SSSE3 kernels
+//
+// Built with -mssse3 and only selected when the CPU reports SSSE3.
+
+#ifdef __SSSE3__
+
+namespace {
+
+static inline void Ssse3Store(__m128i aV, TByte* aDst, TUint aBytes)
+{
+    if (aBytes == 16)
+    {
+        _mm_storeu_si128((__m128i*)aDst, aV);
+        return;
+    }
+
+    _mm_storel_epi64((__m128i*)aDst, aV);
+
+    if (aBytes == 12)
+    {
+        const TUint32 word = (TUint32)_mm_cvtsi128_si32(_mm_srli_si128(aV, 8));
+        memcpy(aDst + 8, &word, sizeof(word));
+    }
+}
+
+template <TUint kSource, TUint kFormat, TUint kMap>
+struct Ssse3Shuffle
+{
+    static void Convert(const TByte* aSrc, TByte* aDst, TUint aSubsamples);
+};
+
+template <TUint kSource, TUint kFormat, TUint kMap>
+void Ssse3Shuffle<kSource, kFormat, kMap>::Convert(const TByte* aSrc,
+                                                  TByte* aDst,
+                                                  TUint aSubsamples)
+{
+    const PcmShuffle& shuffle = kPcmShuffles[kSource][kFormat][kMap];
+    const __m128i mask  = _mm_loadu_si128((const __m128i*)shuffle.iMask);
+    const __m128i flip  = _mm_set1_epi8((char)shuffle.iFlip);
+    constexpr TUint shift = PcmShuffleShift(kFormat);
+    const TUint   bytes = aSubsamples * (kSource + 1);
+    TUint i = 0;
+
+    // Each step loads a full vector, even if it consumes less of it.
+    for (; i + 16 <= bytes; i += shuffle.iInBytes)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(aSrc + i));
+        v = _mm_shuffle_epi8(_mm_xor_si128(v, flip), mask);
+
+        if (shift != 0)
+        {
+            v = _mm_srai_epi32(v, shift);
+        }
+
+        Ssse3Store(v, aDst, shuffle.iOutBytes);
+        aDst += shuffle.iOutBytes;
+    }
+
+    PcmScalarKernel(kSource, kFormat, kMap)(aSrc + i, aDst,
+                                            (bytes - i) / (kSource + 1));
+}
+
+} // namespace
+
+TBool OpenHome::Media::PcmKernelsSsse3(PcmKernelTable& aTable)
+{
+    PcmKernelFiller<Ssse3Shuffle, 0, 0>::Fill(aTable);
+    return true;
+}
+
+#else // __SSSE3__
+
+TBool OpenHome::Media::PcmKernelsSsse3(PcmKernelTable& /*aTable*/)
+{
+    return false;
+}
+
+#endif // __SSSE3__
@@ -0,0 +1,97 @@
+#include <OpenHome/Types.h>
+
+#include <cstring>
+
+#include "PcmRing.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+
+PcmRing::PcmRing()
+: iCapacity(0)
+, iWriteIndex(0)
+, iReadIndex(0)
+, iUsed(0)
+{
+}
+
+void PcmRing::Reset(TUint aFrames, TUint aFrameBytes)
+{
+    ASSERT(iUsed == 0);
+
+    iCapacity = aFrames * aFrameBytes;
+
+    if (iCapacity > iBuffer.MaxBytes())
+    {
+        iBuffer.Grow(iCapacity);
+
+        // Fault the pages in now rather than as the ring first fills.
+        memset((void *)iBuffer.Ptr(), 0, iBuffer.MaxBytes());
+    }
+
+    iWriteIndex = 0;
+    iReadIndex  = 0;
+}
+
+TByte* PcmRing::Write(TUint& aBytes)
+{
+    const TUint free       = iCapacity - iUsed.load();
+    const TUint contiguous = iCapacity - iWriteIndex;
+
+    if (aBytes > free)
+    {
+        aBytes = free;
+    }
+
+    if (aBytes > contiguous)
+    {
+        aBytes = contiguous;
+    }
+
+    return (TByte *)iBuffer.Ptr() + iWriteIndex;
+}
+
+void PcmRing::Commit(TUint aBytes)
+{
+    iWriteIndex += aBytes;
+
+    if (iWriteIndex == iCapacity)
+    {
+        iWriteIndex = 0;
+    }
+
+    iUsed.fetch_add(aBytes);
+}
+
+const TByte* PcmRing::Read(TUint& aBytes)
+{
+    const TUint used       = iUsed.load();
+    const TUint contiguous = iCapacity - iReadIndex;
+
+    aBytes = (used < contiguous) ? used : contiguous;
+
+    return iBuffer.Ptr() + iReadIndex;
+}
+
+void PcmRing::Consume(TUint aBytes)
+{
+    iReadIndex += aBytes;
+
+    if (iReadIndex == iCapacity)
+    {
+        iReadIndex = 0;
+    }
+
+    iUsed.fetch_sub(aBytes);
+}
+
+TUint PcmRing::Bytes() const
+{
+    return iUsed;
+}
+
+TUint PcmRing::Capacity() const
+{
+    return iCapacity;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+#include <OpenHome/Buffer.h>
+
+#include <atomic>
+
+namespace OpenHome {
+namespace Media {
+
+// PcmRing
+//
+// Lock free single producer, single consumer ring of output PCM.
+//
+// The producer asks for contiguous space with Write() and publishes it
+// with Commit(). The consumer asks for contiguous data with Read() and
+// releases it with Consume(). Either side may be handed less than it
+// would like where the ring wraps.
+//
+// The capacity is a whole number of frames and every commit is whole
+// frames, so both sides always see whole frames.
+//
+// Reset() is only safe while the ring is empty and the consumer is idle.
+
+class PcmRing
+{
+public:
+    PcmRing();
+    void         Reset(TUint aFrames, TUint aFrameBytes);
+    TByte*       Write(TUint& aBytes);
+    void         Commit(TUint aBytes);
+    const TByte* Read(TUint& aBytes);
+    void         Consume(TUint aBytes);
+    TUint        Bytes() const;
+    TUint        Capacity() const;
+private:
+    Bwh                iBuffer;
+    TUint              iCapacity;
+    TUint              iWriteIndex;     // producer only
+    TUint              iReadIndex;      // consumer only
+    std::atomic<TUint> iUsed;
+};
+
+} // namespace Media
+} // namespace OpenHome
@@ -0,0 +1,440 @@
+#include <OpenHome/Types.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Printer.h>
+#include <OpenHome/Private/Standard.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "PolyphaseResampler.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Configuration;
+using namespace OpenHome::Media;
+
+
+// Filter design for each quality. Downsampling filters are lengthened to
+// keep the transition band the same width, within reason.
+
+struct ResamplerParams
+{
+    TUint  iTaps;       // per phase, at 1:1
+    double iBeta;       // Kaiser window shape, ~ stopband / 9 dB
+    double iPassband;   // fraction of the narrower Nyquist kept
+};
+
+static const ResamplerParams kResamplerParams[eResamplerQualityCount] =
+{
+    {  0,  0.0, 0.00 },     // Off
+    { 16,  6.0, 0.85 },     // Low
+    { 32,  8.0, 0.90 },     // Medium
+    { 64, 10.0, 0.94 },     // High
+};
+
+static const TUint kMaxTapsScale = 4;
+
+static TUint Gcd(TUint aA, TUint aB)
+{
+    while (aB != 0)
+    {
+        const TUint r = aA % aB;
+        aA = aB;
+        aB = r;
+    }
+
+    return aA;
+}
+
+// Zeroth order modified Bessel function of the first kind.
+static double BesselI0(double aX)
+{
+    double sum  = 1.0;
+    double term = 1.0;
+
+    for (TUint k = 1; term > sum * 1e-12; k++)
+    {
+        const double half = aX / (2.0 * k);
+        term *= half * half;
+        sum  += term;
+    }
+
+    return sum;
+}
+
+static inline float Dot(const float* aA, const float* aB, TUint aCount)
+{
+#if defined(__SSE__)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    TUint  i    = 0;
+
+    for (; i + 8 <= aCount; i += 8)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(aA + i),
+                                           _mm_loadu_ps(aB + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(aA + i + 4),
+                                           _mm_loadu_ps(aB + i + 4)));
+    }
+
+    for (; i < aCount; i += 4)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(aA + i),
+                                           _mm_loadu_ps(aB + i)));
+    }
+
+    __m128 sum = _mm_add_ps(acc0, acc1);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+
+    return _mm_cvtss_f32(sum);
+#elif defined(__ARM_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    TUint       i    = 0;
+
+    for (; i + 8 <= aCount; i += 8)
+    {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(aA + i),     vld1q_f32(aB + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(aA + i + 4), vld1q_f32(aB + i + 4));
+    }
+
+    for (; i < aCount; i += 4)
+    {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(aA + i), vld1q_f32(aB + i));
+    }
+
+    const float32x4_t sum  = vaddq_f32(acc0, acc1);
+    float32x2_t       pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+
+    pair = vpadd_f32(pair, pair);
+
+    return vget_lane_f32(pair, 0);
+#else
+    float acc = 0.0f;
+
+    for (TUint i = 0; i < aCount; i++)
+    {
+        acc += aA[i] * aB[i];
+    }
+
+    return acc;
+#endif
+}
+
+
+// PolyphaseResampler
+
+const TUint PolyphaseResampler::kChunkFrames;
+
+PolyphaseResampler::PolyphaseResampler()
+: iInRate(0)
+, iOutRate(0)
+, iQuality(eResamplerOff)
+, iUp(1)
+, iDown(1)
+, iTaps(0)
+, iChannels(0)
+, iStride(0)
+, iFill(0)
+, iPosition(0)
+, iPhase(0)
+{
+}
+
+TBool PolyphaseResampler::Supports(TUint aInRate, TUint aOutRate)
+{
+    if (aInRate == 0 || aOutRate == 0)
+    {
+        return false;
+    }
+
+    const TUint gcd  = Gcd(aInRate, aOutRate);
+    const TUint up   = aOutRate / gcd;
+    const TUint down = aInRate / gcd;
+
+    // Each output may move the window on by down / up frames, which must
+    // fit in a chunk of history.
+    return up <= kMaxPhases && down / up < kChunkFrames / 2;
+}
+
+TBool PolyphaseResampler::Configure(TUint aInRate, TUint aOutRate,
+                                    ResamplerQuality aQuality)
+{
+    ASSERT(aQuality > eResamplerOff && aQuality < eResamplerQualityCount);
+
+    if (!Supports(aInRate, aOutRate))
+    {
+        return false;
+    }
+
+    if (aInRate == iInRate && aOutRate == iOutRate && aQuality == iQuality)
+    {
+        Reset(iChannels);
+        return true;
+    }
+
+    const ResamplerParams& params = kResamplerParams[aQuality];
+    const TUint            gcd    = Gcd(aInRate, aOutRate);
+
+    iUp   = aOutRate / gcd;
+    iDown = aInRate / gcd;
+    iTaps = params.iTaps *
+            std::min((iDown + iUp - 1) / iUp, kMaxTapsScale);
+
+    // The prototype low pass runs at iUp times the input rate and cuts off
+    // below the lower of the two Nyquist frequencies.
+    const TUint  length = iTaps * iUp;
+    const double cutoff = 0.5 * params.iPassband / std::max(iUp, iDown);
+    const double centre = (length - 1) / 2.0;
+    const double norm   = BesselI0(params.iBeta);
+
+    std::vector<double> prototype(length);
+
+    for (TUint k = 0; k < length; k++)
+    {
+        const double x    = 2.0 * cutoff * (k - centre);
+        const double sinc = (x == 0.0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+        const double r    = (k - centre) / centre;
+        const double w    = BesselI0(params.iBeta * sqrt(std::max(0.0, 1.0 - r * r))) / norm;
+
+        prototype[k] = sinc * w;
+    }
+
+    // Phase p takes every iUp'th tap of the prototype, starting at p, and
+    // is stored oldest input frame first. Each phase is normalised to unit
+    // gain so that no phase is louder than another.
+    iCoeffs.resize(length);
+
+    for (TUint p = 0; p < iUp; p++)
+    {
+        float* coeffs = &iCoeffs[p * iTaps];
+        double sum    = 0.0;
+
+        for (TUint i = 0; i < iTaps; i++)
+        {
+            sum += prototype[p + (iTaps - 1 - i) * iUp];
+        }
+
+        for (TUint i = 0; i < iTaps; i++)
+        {
+            coeffs[i] = (float)(prototype[p + (iTaps - 1 - i) * iUp] / sum);
+        }
+    }
+
+    iStride = iTaps + kChunkFrames;
+    iHistory.assign(kMaxChannels * iStride, 0.0f);
+
+    Log::Print("PolyphaseResampler: %u -> %u Hz, %u/%u, %u taps per phase\n",
+               aInRate, aOutRate, iUp, iDown, iTaps);
+
+    iInRate  = aInRate;
+    iOutRate = aOutRate;
+    iQuality = aQuality;
+
+    Reset(iChannels != 0 ? iChannels : 2);
+    return true;
+}
+
+void PolyphaseResampler::Reset(TUint aChannels)
+{
+    ASSERT(aChannels >= 1 && aChannels <= kMaxChannels);
+    ASSERT(iTaps != 0);
+
+    iChannels = aChannels;
+
+    // Start from silence, which the filter fades in from.
+    std::fill(iHistory.begin(), iHistory.end(), 0.0f);
+
+    iFill     = iTaps - 1;
+    iPosition = 0;
+    iPhase    = 0;
+}
+
+TUint PolyphaseResampler::Channels() const
+{
+    return iChannels;
+}
+
+TUint PolyphaseResampler::DelayFrames() const
+{
+    return iTaps / 2;
+}
+
+TUint PolyphaseResampler::Process(const TInt32* aIn, TUint& aInFrames,
+                                  TInt32* aOut, TUint aOutFrames)
+{
+    static const float kToFloat = 1.0f / 2147483648.0f;
+    static const float kToInt   = 2147483648.0f;
+
+    TUint consumed = 0;
+    TUint written  = 0;
+
+    while (written < aOutFrames)
+    {
+        if (iPosition + iTaps > iFill)
+        {
+            if (consumed == aInFrames)
+            {
+                break;
+            }
+
+            // Drop the history the window has passed and top it up.
+            if (iPosition < iFill)
+            {
+                const TUint keep = iFill - iPosition;
+
+                for (TUint ch = 0; ch < iChannels; ch++)
+                {
+                    float* history = &iHistory[ch * iStride];
+                    memmove(history, history + iPosition, keep * sizeof(float));
+                }
+
+                iFill     = keep;
+                iPosition = 0;
+            }
+            else
+            {
+                iPosition -= iFill;
+                iFill      = 0;
+            }
+
+            const TUint frames = std::min(aInFrames - consumed,
+                                          iStride - iFill);
+            const TInt32* in   = aIn + consumed * iChannels;
+
+            for (TUint ch = 0; ch < iChannels; ch++)
+            {
+                float* history = &iHistory[ch * iStride + iFill];
+
+                for (TUint i = 0; i < frames; i++)
+                {
+                    history[i] = in[i * iChannels + ch] * kToFloat;
+                }
+            }
+
+            consumed += frames;
+            iFill    += frames;
+            continue;
+        }
+
+        const float* coeffs = &iCoeffs[iPhase * iTaps];
+
+        for (TUint ch = 0; ch < iChannels; ch++)
+        {
+            const float v = Dot(&iHistory[ch * iStride + iPosition], coeffs,
+                                iTaps) * kToInt;
+
+            // The filter can ring past full scale.
+            if (v >= 2147483647.0f)
+            {
+                *aOut++ = 0x7fffffff;
+            }
+            else if (v <= -2147483648.0f)
+            {
+                *aOut++ = (TInt32)0x80000000;
+            }
+            else
+            {
+                *aOut++ = (TInt32)lrintf(v);
+            }
+        }
+
+        written++;
+
+        iPhase    += iDown;
+        iPosition += iPhase / iUp;
+        iPhase    %= iUp;
+    }
+
+    aInFrames = consumed;
+    return written;
+}
+
+
+// ConfigResampler
+
+const Brn ConfigResampler::kKey("Alsa.Resampler");
+
+ConfigResampler::ConfigResampler(IConfigInitialiser& aConfigInit)
+: iLock("ALRS")
+, iConfig(nullptr)
+, iSubscriberId(IConfigManager::kSubscriptionIdInvalid)
+, iQuality(eResamplerMedium)
+{
+    std::vector<TUint> choices;
+
+    for (TUint i = 0; i < eResamplerQualityCount; i++)
+    {
+        choices.push_back(i);
+    }
+
+    iConfig = new ConfigChoice(aConfigInit, kKey, choices, eResamplerMedium,
+                               *this);
+    iSubscriberId = iConfig->Subscribe(
+        MakeFunctorConfigChoice(*this, &ConfigResampler::QualityChanged));
+}
+
+ConfigResampler::~ConfigResampler()
+{
+    iConfig->Unsubscribe(iSubscriberId);
+    delete iConfig;
+}
+
+void ConfigResampler::Add(IResamplerObserver& aObserver)
+{
+    AutoMutex _(iLock);
+    iObservers.push_back(&aObserver);
+    aObserver.ResamplerQualityChanged(iQuality);
+}
+
+void ConfigResampler::Remove(IResamplerObserver& aObserver)
+{
+    AutoMutex _(iLock);
+
+    for (auto it = iObservers.begin(); it != iObservers.end(); ++it)
+    {
+        if (*it == &aObserver)
+        {
+            iObservers.erase(it);
+            return;
+        }
+    }
+}
+
+void ConfigResampler::Write(IWriter& aWriter,
+                            IConfigChoiceMappingWriter& aMappingWriter)
+{
+    static const TChar* kNames[eResamplerQualityCount] =
+    {
+        "Off", "Low", "Medium", "High"
+    };
+
+    for (TUint i = 0; i < eResamplerQualityCount; i++)
+    {
+        aMappingWriter.Write(aWriter, i, Brn(kNames[i]));
+    }
+
+    aMappingWriter.WriteComplete(aWriter);
+}
+
+void ConfigResampler::QualityChanged(KeyValuePair<TUint>& aKvp)
+{
+    AutoMutex _(iLock);
+
+    iQuality = (aKvp.Value() < eResamplerQualityCount) ?
+                   (ResamplerQuality)aKvp.Value() : eResamplerMedium;
+
+    Log::Print("ConfigResampler: Quality %u\n", iQuality);
+
+    for (IResamplerObserver* observer : iObservers)
+    {
+        observer->ResamplerQualityChanged(iQuality);
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+#include <OpenHome/Configuration/ConfigManager.h>
+#include <OpenHome/Private/Thread.h>
+
+#include <vector>
+
+namespace OpenHome {
+namespace Media {
+
+enum ResamplerQuality
+{
+    eResamplerOff,
+    eResamplerLow,
+    eResamplerMedium,
+    eResamplerHigh,
+    eResamplerQualityCount
+};
+
+// PolyphaseResampler
+//
+// Converts interleaved 32 bit audio between two fixed sample rates, so that
+// streams at rates the device can't open are played at one it can.
+//
+// The rates' ratio is reduced to L/M and the audio filtered through L
+// phases of a Kaiser windowed sinc, each phase a dot product over the last
+// few input frames. The dot products run four floats at a time with SSE on
+// x86 and NEON on ARM builds that have it. The quality sets the number of
+// taps per phase, the stopband and the passband width.
+//
+// Configure() allocates and designs the filter, so is for stream
+// boundaries only. Process() doesn't allocate.
+
+class PolyphaseResampler
+{
+public:
+    static const TUint kMaxChannels = 8;
+public:
+    PolyphaseResampler();
+    // Returns false if the ratio of the rates is too awkward to filter.
+    static TBool Supports(TUint aInRate, TUint aOutRate);
+    // Designs the filter, unless it is already the one asked for.
+    TBool Configure(TUint aInRate, TUint aOutRate, ResamplerQuality aQuality);
+    void  Reset(TUint aChannels);
+    TUint Channels() const;
+    // The filter's delay, in input frames.
+    TUint DelayFrames() const;
+    // As AdaptiveResampler::Process().
+    TUint Process(const TInt32* aIn, TUint& aInFrames,
+                  TInt32* aOut, TUint aOutFrames);
+private:
+    static const TUint kMaxPhases = 1024;
+    static const TUint kChunkFrames = 256;
+private:
+    TUint              iInRate;
+    TUint              iOutRate;
+    ResamplerQuality   iQuality;
+    TUint              iUp;         // L
+    TUint              iDown;       // M
+    TUint              iTaps;       // per phase, a multiple of 4
+    TUint              iChannels;
+    TUint              iStride;     // history floats per channel
+    std::vector<float> iCoeffs;     // iUp phases of iTaps, oldest tap first
+    std::vector<float> iHistory;    // kMaxChannels planar channels
+    TUint              iFill;       // frames of history held
+    TUint              iPosition;   // first history frame of the next output
+    TUint              iPhase;
+};
+
+// IResamplerObserver
+//
+// Told the resampler quality when it is first known and each time it
+// changes. May be called on any thread.
+
+class IResamplerObserver
+{
+public:
+    virtual void ResamplerQualityChanged(ResamplerQuality aQuality) = 0;
+    virtual ~IResamplerObserver() {}
+};
+
+// ConfigResampler
+//
+// Config store backed choice of resampler quality. Off drops streams the
+// device can't play, as before.
+
+class ConfigResampler : private Configuration::IConfigChoiceMapper
+{
+public:
+    static const Brn kKey;
+public:
+    ConfigResampler(Configuration::IConfigInitialiser& aConfigInit);
+    ~ConfigResampler();
+    void Add(IResamplerObserver& aObserver);
+    void Remove(IResamplerObserver& aObserver);
+private: // from IConfigChoiceMapper
+    void Write(IWriter& aWriter,
+               Configuration::IConfigChoiceMappingWriter& aMappingWriter) override;
+private:
+    void QualityChanged(Configuration::KeyValuePair<TUint>& aKvp);
+private:
+    Mutex                            iLock;
+    std::vector<IResamplerObserver*> iObservers;
+    Configuration::ConfigChoice*     iConfig;
+    TUint                            iSubscriberId;
+    ResamplerQuality                 iQuality;
+};
+
+} // namespace Media
+} // namespace OpenHome
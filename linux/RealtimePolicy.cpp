@@ -0,0 +1,360 @@
+#include <OpenHome/Types.h>
+#include <OpenHome/Private/Printer.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "RealtimePolicy.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Configuration;
+using namespace OpenHome::Media;
+
+
+// RealtimePolicy
+
+static const TChar* kThreadNames[eRealtimeThreadCount] =
+{
+    "Animator",
+    "Writer"
+};
+
+// Choice values of Alsa.Realtime.Policy.
+static const TUint kPolicyOff        = 0;
+static const TUint kPolicyFifo       = 1;
+static const TUint kPolicyRoundRobin = 2;
+
+static const TChar* kPolicyNames[] =
+{
+    "Off",
+    "FIFO",
+    "Round robin"
+};
+
+static const TChar* kMemLockNames[] =
+{
+    "Off",
+    "On"
+};
+
+RealtimePolicy::ChoiceNames::ChoiceNames(const TChar* const* aNames,
+                                         TUint aCount)
+: iNames(aNames)
+, iCount(aCount)
+{
+}
+
+void RealtimePolicy::ChoiceNames::Write(IWriter& aWriter,
+                                        IConfigChoiceMappingWriter& aMappingWriter)
+{
+    for (TUint i = 0; i < iCount; i++)
+    {
+        aMappingWriter.Write(aWriter, i, Brn(iNames[i]));
+    }
+
+    aMappingWriter.WriteComplete(aWriter);
+}
+
+RealtimePolicy::RealtimePolicy(IConfigInitialiser& aConfigInit)
+: iPolicyNames(kPolicyNames, sizeof(kPolicyNames) / sizeof(kPolicyNames[0]))
+, iMemLockNames(kMemLockNames,
+                sizeof(kMemLockNames) / sizeof(kMemLockNames[0]))
+, iLock("ALRT")
+, iPolicy(SCHED_OTHER)
+, iPriority(70)
+, iMemLock(false)
+, iMemLocked(false)
+{
+    const std::vector<TUint> policies = { kPolicyOff, kPolicyFifo,
+                                          kPolicyRoundRobin };
+    const std::vector<TUint> onOff    = { 0, 1 };
+
+    iPolicyConfig = new ConfigChoice(aConfigInit, Brn("Alsa.Realtime.Policy"),
+                                     policies, kPolicyOff, iPolicyNames);
+    iPolicySubscriberId = iPolicyConfig->Subscribe(
+        MakeFunctorConfigChoice(*this, &RealtimePolicy::PolicyChanged));
+
+    iPriorityConfig = new ConfigNum(aConfigInit,
+                                    Brn("Alsa.Realtime.Priority"), 1, 99, 70);
+    iPrioritySubscriberId = iPriorityConfig->Subscribe(
+        MakeFunctorConfigNum(*this, &RealtimePolicy::PriorityChanged));
+
+    iMemLockConfig = new ConfigChoice(aConfigInit,
+                                      Brn("Alsa.Realtime.MemLock"),
+                                      onOff, 0, iMemLockNames);
+    iMemLockSubscriberId = iMemLockConfig->Subscribe(
+        MakeFunctorConfigChoice(*this, &RealtimePolicy::MemLockChanged));
+
+    for (TUint i = 0; i < eRealtimeThreadCount; i++)
+    {
+        Bws<64> key("Alsa.Realtime.Cpus.");
+        key.Append(kThreadNames[i]);
+
+        iCpusConfig[i] = new ConfigText(aConfigInit, key, 0, kMaxCpusBytes,
+                                        Brx::Empty());
+    }
+
+    iCpusSubscriberId[eRealtimeAnimator] =
+        iCpusConfig[eRealtimeAnimator]->Subscribe(
+            MakeFunctorConfigText(*this,
+                                  &RealtimePolicy::AnimatorCpusChanged));
+    iCpusSubscriberId[eRealtimeWriter] =
+        iCpusConfig[eRealtimeWriter]->Subscribe(
+            MakeFunctorConfigText(*this, &RealtimePolicy::WriterCpusChanged));
+}
+
+RealtimePolicy::~RealtimePolicy()
+{
+    for (TUint i = 0; i < eRealtimeThreadCount; i++)
+    {
+        iCpusConfig[i]->Unsubscribe(iCpusSubscriberId[i]);
+        delete iCpusConfig[i];
+    }
+
+    iMemLockConfig->Unsubscribe(iMemLockSubscriberId);
+    delete iMemLockConfig;
+    iPriorityConfig->Unsubscribe(iPrioritySubscriberId);
+    delete iPriorityConfig;
+    iPolicyConfig->Unsubscribe(iPolicySubscriberId);
+    delete iPolicyConfig;
+}
+
+void RealtimePolicy::PolicyChanged(KeyValuePair<TUint>& aKvp)
+{
+    AutoMutex _(iLock);
+
+    switch (aKvp.Value())
+    {
+    case kPolicyFifo:
+        iPolicy = SCHED_FIFO;
+        break;
+    case kPolicyRoundRobin:
+        iPolicy = SCHED_RR;
+        break;
+    default:
+        iPolicy = SCHED_OTHER;
+        break;
+    }
+}
+
+void RealtimePolicy::PriorityChanged(KeyValuePair<TInt>& aKvp)
+{
+    AutoMutex _(iLock);
+    iPriority = (TUint)aKvp.Value();
+}
+
+void RealtimePolicy::MemLockChanged(KeyValuePair<TUint>& aKvp)
+{
+    // Only read by LockMemory(), as the driver starts.
+    AutoMutex _(iLock);
+    iMemLock = (aKvp.Value() != 0);
+}
+
+void RealtimePolicy::AnimatorCpusChanged(KeyValuePair<const Brx&>& aKvp)
+{
+    AutoMutex _(iLock);
+    iCpus[eRealtimeAnimator].Replace(aKvp.Value());
+}
+
+void RealtimePolicy::WriterCpusChanged(KeyValuePair<const Brx&>& aKvp)
+{
+    AutoMutex _(iLock);
+    iCpus[eRealtimeWriter].Replace(aKvp.Value());
+}
+
+void RealtimePolicy::LockMemory()
+{
+    {
+        AutoMutex _(iLock);
+
+        if (!iMemLock)
+        {
+            return;
+        }
+    }
+
+    // With MCL_FUTURE every later mapping counts against the limit, and
+    // one over it fails outright, so only lock when nothing will be
+    // refused.
+    struct rlimit limit;
+
+    if (geteuid() != 0 &&
+        getrlimit(RLIMIT_MEMLOCK, &limit) == 0 &&
+        limit.rlim_cur != RLIM_INFINITY)
+    {
+        Log::Print("DriverAlsa: Memory not locked, RLIMIT_MEMLOCK is %lu KB. "
+                   "Raise it to unlimited to lock.\n",
+                   (unsigned long)(limit.rlim_cur / 1024));
+        return;
+    }
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        Log::Print("DriverAlsa: Memory not locked : %s\n", strerror(errno));
+        return;
+    }
+
+    iMemLocked = true;
+
+    Log::Print("DriverAlsa: Memory locked\n");
+}
+
+void RealtimePolicy::Apply(RealtimeThread aThread)
+{
+    ApplyAffinity(aThread);
+    ApplyPolicy(aThread);
+
+    if (iMemLocked)
+    {
+        PrefaultStack();
+    }
+}
+
+void RealtimePolicy::ApplyPolicy(RealtimeThread aThread)
+{
+    TInt schedPolicy;
+    TInt priority;
+
+    {
+        AutoMutex _(iLock);
+        schedPolicy = iPolicy;
+        priority    = (TInt)iPriority;
+    }
+
+    if (schedPolicy == SCHED_OTHER)
+    {
+        return;
+    }
+
+    // The writer feeds the device, so it preempts the animator filling
+    // its ring.
+    const TInt max = sched_get_priority_max(schedPolicy);
+    const TInt min = sched_get_priority_min(schedPolicy);
+
+    if (aThread == eRealtimeAnimator)
+    {
+        priority--;
+    }
+
+    priority = std::min(std::max(priority, min), max);
+
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+
+    TInt err = pthread_setschedparam(pthread_self(), schedPolicy, &param);
+
+    // Without CAP_SYS_NICE an unprivileged process may still go as high
+    // as RLIMIT_RTPRIO.
+    struct rlimit limit;
+
+    if (err == EPERM &&
+        getrlimit(RLIMIT_RTPRIO, &limit) == 0 &&
+        limit.rlim_cur > 0 &&
+        limit.rlim_cur < (rlim_t)priority)
+    {
+        param.sched_priority = (TInt)limit.rlim_cur;
+        err = pthread_setschedparam(pthread_self(), schedPolicy, &param);
+    }
+
+    const TChar* policy =
+        (schedPolicy == SCHED_RR) ? "SCHED_RR" : "SCHED_FIFO";
+
+    if (err != 0)
+    {
+        Log::Print("DriverAlsa: %s thread left at default scheduling, "
+                   "%s %d refused : %s. Needs CAP_SYS_NICE or "
+                   "RLIMIT_RTPRIO.\n",
+                   kThreadNames[aThread], policy, priority, strerror(err));
+        return;
+    }
+
+    Log::Print("DriverAlsa: %s thread %s %d\n",
+               kThreadNames[aThread], policy, param.sched_priority);
+}
+
+void RealtimePolicy::ApplyAffinity(RealtimeThread aThread)
+{
+    Bws<kMaxCpusBytes> cpus;
+
+    {
+        AutoMutex _(iLock);
+        cpus.Replace(iCpus[aThread]);
+    }
+
+    if (cpus.Bytes() == 0)
+    {
+        return;
+    }
+
+    // A list of CPUs and ranges of them, as "0,2-3".
+    Bws<kMaxCpusBytes + 1> list(cpus);
+    cpu_set_t               set;
+    const TChar*            p = list.PtrZ();
+
+    CPU_ZERO(&set);
+
+    while (*p != '\0')
+    {
+        TChar* end;
+        TUint  first = strtoul(p, &end, 10);
+        TUint  last  = first;
+
+        if (end == p)
+        {
+            break;
+        }
+
+        if (*end == '-')
+        {
+            p    = end + 1;
+            last = strtoul(p, &end, 10);
+        }
+
+        for (TUint cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET(cpu, &set);
+        }
+
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    if (*p != '\0' || CPU_COUNT(&set) == 0)
+    {
+        Log::Print("DriverAlsa: %s thread CPUs \"%.*s\" not understood\n",
+                   kThreadNames[aThread], PBUF(cpus));
+        return;
+    }
+
+    const TInt err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    if (err != 0)
+    {
+        Log::Print("DriverAlsa: %s thread not pinned to CPUs %.*s : %s\n",
+                   kThreadNames[aThread], PBUF(cpus), strerror(err));
+        return;
+    }
+
+    Log::Print("DriverAlsa: %s thread pinned to CPUs %.*s\n",
+               kThreadNames[aThread], PBUF(cpus));
+}
+
+void RealtimePolicy::PrefaultStack()
+{
+    // Touch the stack the thread will use, so the first deep call in
+    // playback doesn't fault. Locked memory keeps it resident.
+    TByte stack[kStackPrefaultBytes];
+    volatile TByte* p = stack;
+
+    for (TUint i = 0; i < kStackPrefaultBytes; i += 4096)
+    {
+        p[i] = 0;
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Configuration/ConfigManager.h>
+#include <OpenHome/Private/Thread.h>
+
+namespace OpenHome {
+namespace Media {
+
+enum RealtimeThread
+{
+    eRealtimeAnimator,
+    eRealtimeWriter,
+    eRealtimeThreadCount
+};
+
+// RealtimePolicy
+//
+// How DriverAlsa's audio threads are scheduled. ohNet's priorities map to
+// nice levels on Linux, which don't stop a busy box taking the CPU away
+// from audio for long enough to underrun.
+//
+// Config values, taken up as each thread starts:
+//
+//   Alsa.Realtime.Policy          Off, FIFO or Round robin. Off by default,
+//                                 as a real time thread that spins can
+//                                 lock up a single core box, and most
+//                                 installs lack the rights for it anyway.
+//   Alsa.Realtime.Priority        1 to 99, for the writer thread. The
+//                                 animator runs one below.
+//   Alsa.Realtime.MemLock         Lock the process into memory. Off by
+//                                 default, as it locks the whole player,
+//                                 GUI and all.
+//   Alsa.Realtime.Cpus.Animator   CPUs a thread may run on, as "2" or
+//   Alsa.Realtime.Cpus.Writer     "2,3" or "0-1". Empty for any.
+//
+// Nothing here is fatal. Without CAP_SYS_NICE the priority is capped at
+// RLIMIT_RTPRIO, and with neither the thread keeps ohNet's scheduling.
+// Either is logged.
+
+class RealtimePolicy
+{
+    static const TUint kMaxCpusBytes = 32;
+    static const TUint kStackPrefaultBytes = 16 * 1024;    // well inside ohNet stacks
+public:
+    RealtimePolicy(Configuration::IConfigInitialiser& aConfigInit);
+    ~RealtimePolicy();
+    // Once, before the audio threads start.
+    void LockMemory();
+    // From the thread itself, as it starts.
+    void Apply(RealtimeThread aThread);
+private:
+    class ChoiceNames : public Configuration::IConfigChoiceMapper
+    {
+    public:
+        ChoiceNames(const TChar* const* aNames, TUint aCount);
+    private: // from IConfigChoiceMapper
+        void Write(IWriter& aWriter,
+                   Configuration::IConfigChoiceMappingWriter& aMappingWriter) override;
+    private:
+        const TChar* const* iNames;
+        const TUint         iCount;
+    };
+private:
+    void  PolicyChanged(Configuration::KeyValuePair<TUint>& aKvp);
+    void  PriorityChanged(Configuration::KeyValuePair<TInt>& aKvp);
+    void  MemLockChanged(Configuration::KeyValuePair<TUint>& aKvp);
+    void  AnimatorCpusChanged(Configuration::KeyValuePair<const Brx&>& aKvp);
+    void  WriterCpusChanged(Configuration::KeyValuePair<const Brx&>& aKvp);
+    void  ApplyPolicy(RealtimeThread aThread);
+    void  ApplyAffinity(RealtimeThread aThread);
+    static void PrefaultStack();
+private:
+    ChoiceNames                  iPolicyNames;
+    ChoiceNames                  iMemLockNames;
+    Configuration::ConfigChoice* iPolicyConfig;
+    Configuration::ConfigNum*    iPriorityConfig;
+    Configuration::ConfigChoice* iMemLockConfig;
+    Configuration::ConfigText*   iCpusConfig[eRealtimeThreadCount];
+    TUint                        iPolicySubscriberId;
+    TUint                        iPrioritySubscriberId;
+    TUint                        iMemLockSubscriberId;
+    TUint                        iCpusSubscriberId[eRealtimeThreadCount];
+    Mutex                        iLock;
+    TInt                         iPolicy;    // SCHED_OTHER for off
+    TUint                        iPriority;
+    TBool                        iMemLock;
+    TBool                        iMemLocked;
+    Bws<kMaxCpusBytes>           iCpus[eRealtimeThreadCount];
+};
+
+} // namespace Media
+} // namespace OpenHome
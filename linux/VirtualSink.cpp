@@ -0,0 +1,215 @@
+#include <OpenHome/Types.h>
+#include <OpenHome/Private/Printer.h>
+
+#include <cstring>
+#include <thread>
+#include <time.h>
+
+#include "VirtualSink.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Configuration;
+using namespace OpenHome::Media;
+
+
+// VirtualSink
+
+const TChar* VirtualSink::kPrefix = "sink:";
+
+const TChar* VirtualSink::kDevices[] =
+{
+    "sink:null",
+    "sink:null,fast",
+    "sink:wav",
+    "sink:wav,fast"
+};
+
+const TChar* VirtualSink::kDescriptions[] =
+{
+    "No output",
+    "No output, at full speed",
+    "WAV file",
+    "WAV file, at full speed"
+};
+
+static const Brn   kWavFileKey("Alsa.Sink.WavFile");
+static const TChar kWavFileDefault[] = "/tmp/ohPlayer.wav";
+
+VirtualSink::VirtualSink(IStoreReadWrite& aStore)
+: iActive(false)
+, iClocked(true)
+, iRate(0)
+, iBufferFrames(0)
+, iStartNs(0)
+, iFrames(0)
+{
+    try
+    {
+        aStore.Read(kWavFileKey, iWavFile);
+    }
+    catch (StoreKeyNotFound&)
+    {
+        iWavFile.Replace(Brn(kWavFileDefault));
+        aStore.Write(kWavFileKey, iWavFile);
+    }
+    catch (StoreReadBufferUndersized&)
+    {
+        iWavFile.Replace(Brn(kWavFileDefault));
+    }
+}
+
+TBool VirtualSink::Is(const TChar* aDevice)
+{
+    return strncmp(aDevice, kPrefix, strlen(kPrefix)) == 0;
+}
+
+TInt VirtualSink::Open(snd_pcm_t** aHandle, const TChar* aDevice)
+{
+    const Brn   device(aDevice);
+    const TBool wav = device.BeginsWith(Brn("sink:wav"));
+    Bws<kMaxConfigBytes> config;
+
+    if (wav)
+    {
+        config.AppendPrintf("pcm.sink { type file "
+                            "slave { pcm { type null } } "
+                            "file \"%.*s\" format wav }", PBUF(iWavFile));
+    }
+    else if (device.BeginsWith(Brn("sink:null")))
+    {
+        config.Replace(Brn("pcm.sink { type null }"));
+    }
+    else
+    {
+        return -ENOENT;
+    }
+
+    snd_config_t* top;
+    snd_input_t*  input;
+
+    auto err = snd_config_top(&top);
+    if (err < 0)
+    {
+        return err;
+    }
+
+    err = snd_input_buffer_open(&input, (const char*)config.Ptr(),
+                                config.Bytes());
+    if (err == 0)
+    {
+        err = snd_config_load(top, input);
+        snd_input_close(input);
+    }
+
+    if (err == 0)
+    {
+        err = snd_pcm_open_lconf(aHandle, "sink", SND_PCM_STREAM_PLAYBACK, 0,
+                                 top);
+    }
+
+    snd_config_delete(top);
+
+    if (err < 0)
+    {
+        return err;
+    }
+
+    iClocked = (strstr(aDevice, ",fast") == nullptr);
+    iActive  = true;
+    Reset();
+
+    Log::Print("VirtualSink: %s%s%s\n", aDevice, wav ? " to " : "",
+               wav ? iWavFile.PtrZ() : "");
+
+    return 0;
+}
+
+void VirtualSink::Close()
+{
+    iActive = false;
+}
+
+TBool VirtualSink::Active() const
+{
+    return iActive;
+}
+
+void VirtualSink::Start(TUint aRate, TUint aBufferFrames)
+{
+    iRate         = aRate;
+    iBufferFrames = aBufferFrames;
+
+    Reset();
+}
+
+void VirtualSink::Reset()
+{
+    iStartNs = 0;
+    iFrames  = 0;
+}
+
+TBool VirtualSink::Dry() const
+{
+    if (!iActive || !iClocked || iStartNs == 0)
+    {
+        return false;
+    }
+
+    // Played everything written some time ago.
+    return ElapsedFrames(NowNs()) > (TInt64)iFrames;
+}
+
+void VirtualSink::Written(TUint aFrames)
+{
+    if (iStartNs == 0)
+    {
+        iStartNs = NowNs();
+    }
+
+    iFrames += aFrames;
+}
+
+void VirtualSink::Wait()
+{
+    if (!iActive || !iClocked || iRate == 0 || iStartNs == 0)
+    {
+        return;
+    }
+
+    // Wait, as a full hardware buffer would, until the simulated DAC has
+    // played enough to make room for what was just written.
+    const TInt64 ahead =
+        (TInt64)iFrames - ElapsedFrames(NowNs()) - (TInt64)iBufferFrames;
+
+    if (ahead > 0)
+    {
+        std::this_thread::sleep_for(
+            std::chrono::nanoseconds((ahead * 1000000000) / iRate));
+    }
+}
+
+TUint VirtualSink::DelayFrames() const
+{
+    if (!iClocked || iStartNs == 0)
+    {
+        return 0;
+    }
+
+    const TInt64 delay = (TInt64)iFrames - ElapsedFrames(NowNs());
+
+    return (delay > 0) ? (TUint)delay : 0;
+}
+
+TInt64 VirtualSink::NowNs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (TInt64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+TInt64 VirtualSink::ElapsedFrames(TInt64 aNowNs) const
+{
+    // In microseconds, so that hours of 192kHz don't overflow.
+    return (((aNowNs - iStartNs) / 1000) * iRate) / 1000000;
+}
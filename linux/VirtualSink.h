@@ -0,0 +1,75 @@
+#pragma once
+
+#include <OpenHome/Types.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Configuration/IStore.h>
+#include <alsa/asoundlib.h>
+
+#include <atomic>
+
+namespace OpenHome {
+namespace Media {
+
+// VirtualSink
+//
+// Outputs for running without sound hardware, as in CI containers and
+// throughput tests, chosen like any other device by name:
+//
+//   sink:null        discards audio at the rate a DAC would play it
+//   sink:null,fast   discards audio as fast as the pipeline delivers it
+//   sink:wav         writes the device's output, bit for bit, to the WAV
+//   sink:wav,fast    file named by Alsa.Sink.WavFile in the store
+//
+// Each is an ALSA PCM built from its null and file plugins, so DriverAlsa
+// converts, buffers and recovers exactly as it does for hardware. A WAV
+// file holds one output format, so a capture should keep to streams that
+// share one.
+//
+// The null plugin takes whatever it is given at once, so a DAC's clock is
+// simulated here. Wait() holds the writer back so it is never more than a
+// hardware buffer ahead, DelayFrames() is how far ahead it is, and Dry()
+// says when it has fallen behind, where a DAC would have underrun. At full
+// speed nothing is held back, delayed or run dry.
+
+class VirtualSink
+{
+    static const TUint kMaxPathBytes = 256;
+    static const TUint kMaxConfigBytes = kMaxPathBytes + 128;
+public:
+    static const TChar* kPrefix;
+    static const TChar* kDevices[];
+    static const TChar* kDescriptions[];
+    static const TUint  kDeviceCount = 4;
+public:
+    VirtualSink(Configuration::IStoreReadWrite& aStore);
+    static TBool Is(const TChar* aDevice);
+    // Opens aDevice, one of kDevices, in place of snd_pcm_open().
+    TInt  Open(snd_pcm_t** aHandle, const TChar* aDevice);
+    void  Close();
+    TBool Active() const;
+    // For each configuration of the PCM.
+    void  Start(TUint aRate, TUint aBufferFrames);
+    // Whenever the PCM's contents are dropped or paused.
+    void  Reset();
+    // Before counting a write. The caller treats it as an underrun and
+    // resets.
+    TBool Dry() const;
+    void  Written(TUint aFrames);
+    // After a write, and outside any lock the writer holds.
+    void  Wait();
+    TUint DelayFrames() const;
+private:
+    static TInt64 NowNs();
+    TInt64 ElapsedFrames(TInt64 aNowNs) const;
+private:
+    Bws<kMaxPathBytes>   iWavFile;
+    std::atomic<TBool>   iActive;
+    TBool                iClocked;
+    std::atomic<TUint>   iRate;
+    std::atomic<TUint>   iBufferFrames;
+    std::atomic<TInt64>  iStartNs;     // 0 until written to
+    std::atomic<TUint64> iFrames;
+};
+
+} // namespace Media
+} // namespace OpenHome
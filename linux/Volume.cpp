@@ -5,6 +5,7 @@
 #include <alsa/asoundlib.h>
 #include <math.h>
 
+#include "AlsaDevice.h"
 #include "Volume.h"
 
 using namespace OpenHome;
@@ -80,13 +81,62 @@ IVolumeProfile::StartupVolume VolumeProfile::StartupVolumeConfig() const
 
 
 VolumeControl::VolumeControl()
+    : iLock("VOLC")
+    , iCard(ConfigAlsaDevice::kDefaultDevice)
+    , iHandle(NULL)
+    , iElem(NULL)
+    , iVolumeSet(false)
+    , iVolume(0)
+{
+    Attach(iCard.PtrZ());
+}
+
+VolumeControl::~VolumeControl()
+{
+    Detach();
+}
+
+TBool VolumeControl::IsVolumeSupported()
+{
+    AutoMutex _(iLock);
+    return (iElem != NULL);
+}
+
+void VolumeControl::AlsaDeviceChanged(const Brx& aDevice)
+{
+    Bws<kMaxCardBytes> card;
+
+    ConfigAlsaDevice::MixerCard(aDevice, card);
+
+    AutoMutex _(iLock);
+
+    if (card == iCard)
+    {
+        return;
+    }
+
+    Log::Print("VolumeControl: Using mixer for %.*s\n", PBUF(card));
+
+    Detach();
+    iCard.Replace(card);
+    Attach(iCard.PtrZ());
+
+    // The new card starts wherever it was left, so bring it into line.
+    if (iVolumeSet)
+    {
+        ApplyVolume(iVolume);
+    }
+}
+
+void VolumeControl::Attach(const TChar* aCard)
 {
-    const TChar *CARD          = "default";
     const TChar *SELEM_NAMES[] = {"Digital", "PCM", "Master"};
 
-    // Get the mixer element for the default sound card.
+    iElem = NULL;
+
+    // Get the mixer element for the sound card.
     snd_mixer_open(&iHandle, 0);
-    snd_mixer_attach(iHandle, CARD);
+    snd_mixer_attach(iHandle, aCard);
     snd_mixer_selem_register(iHandle, NULL, NULL);
     snd_mixer_load(iHandle);
 
@@ -113,17 +163,24 @@ VolumeControl::VolumeControl()
 
 }
 
-VolumeControl::~VolumeControl()
+void VolumeControl::Detach()
 {
     snd_mixer_close(iHandle);
+    iHandle = NULL;
+    iElem   = NULL;
 }
 
-TBool VolumeControl::IsVolumeSupported()
+void VolumeControl::SetVolume(TUint aVolume)
 {
-    return (iElem != NULL);
+    AutoMutex _(iLock);
+
+    iVolume    = aVolume;
+    iVolumeSet = true;
+
+    ApplyVolume(aVolume);
 }
 
-void VolumeControl::SetVolume(TUint aVolume)
+void VolumeControl::ApplyVolume(TUint aVolume)
 {
     const long  MAX_LINEAR_DB_SCALE = 24;
     const TUint MILLI_DB_PER_STEP   = 1024;
@@ -133,7 +190,7 @@ void VolumeControl::SetVolume(TUint aVolume)
     TInt        err;
 
     // Sanity Check
-    if (! IsVolumeSupported())
+    if (iElem == NULL)
     {
         return;
     }
@@ -7,6 +7,8 @@
 
 #include <alsa/asoundlib.h>
 
+#include "AlsaDevice.h"
+
 namespace OpenHome {
 namespace Av {
 
@@ -44,15 +46,27 @@ private: // from IVolumeProfile
     StartupVolume StartupVolumeConfig() const override;
 };
 
-class VolumeControl : public IVolume, public IBalance, public IFade
+class VolumeControl : public IVolume, public IBalance, public IFade,
+                      public Media::IAlsaDeviceObserver
 {
+    static const TUint kMaxCardBytes = 64;
 public:
     VolumeControl();
     ~VolumeControl();
     TBool IsVolumeSupported();
+public: // from Media::IAlsaDeviceObserver
+    void AlsaDeviceChanged(const Brx& aDevice) override;
+private:
+    void Attach(const TChar* aCard);
+    void Detach();
+    void ApplyVolume(TUint aVolume);
 private:
+    Mutex                 iLock;
+    Bws<kMaxCardBytes>    iCard;      // Card the mixer is attached to.
     snd_mixer_t          *iHandle;    // ALSA mixer handle.
     snd_mixer_elem_t     *iElem;      // PCM mixer element
+    TBool                 iVolumeSet;
+    TUint                 iVolume;    // Last volume, reapplied on a new card.
 private: // from IVolume
     void SetVolume(TUint aVolume) override;
 private: // from IBalance
@@ -0,0 +1,408 @@
+// KernelBench
+//
+// Checks and times every PCM conversion kernel the driver can select: the
+// scalar PcmConverter set and each instruction set specific one this build
+// and CPU have, one at a time.
+//
+// Each kernel is first compared, bit for bit, with a plain reference
+// conversion over every length up to a few vector widths, so the tails are
+// covered, with guard bytes after the output to catch overruns. It is
+// then timed over whole fragments of audio for several channel counts and
+// fragment sizes, reporting source bytes per second and CPU cycles per
+// output subsample. Cycles come from the perf cycle counter, or the TSC
+// on x86 where perf isn't allowed.
+//
+// Needs no audio device. Exits non zero if any kernel isn't bit exact, so
+// that it can gate changes to the conversion code.
+//
+// Usage: KernelBench [tier]
+
+#include <OpenHome/Types.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "PcmKernels.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+
+static const TUint kMaxChannels  = 8;
+static const TUint kMaxFrames    = 4096;
+static const TUint kCheckLengths = 200;     // subsamples, every length below
+static const TUint kGuardBytes   = 64;
+static const TByte kGuard        = 0xa5;
+static const double kMinTimedSecs = 0.05;
+
+static const TUint kFrames[]   = { 64, 1024, 4096 };
+static const TUint kChannels[] = { 1, 2, 6 };
+
+
+// Reference conversion, written for clarity rather than speed.
+
+static TUint32 ReferenceRead(const TByte* aSrc, TUint aBytes)
+{
+    TUint32 sample = 0;
+
+    for (TUint i = 0; i < aBytes; i++)
+    {
+        sample = (sample << 8) | aSrc[i];
+    }
+
+    sample <<= (4 - aBytes) * 8;
+
+    // 8 bit PCM is unsigned.
+    if (aBytes == 1)
+    {
+        sample ^= 0x80000000;
+    }
+
+    return sample;
+}
+
+static TByte* ReferenceWrite(TUint32 aSample, snd_pcm_format_t aFormat,
+                             TByte* aDst)
+{
+    TUint32 value = aSample;
+    TUint   bytes = 4;
+
+    switch (aFormat)
+    {
+        case SND_PCM_FORMAT_S16_LE:
+            value = aSample >> 16;
+            bytes = 2;
+            break;
+        case SND_PCM_FORMAT_S24_3LE:
+            value = aSample >> 8;
+            bytes = 3;
+            break;
+        case SND_PCM_FORMAT_S24_LE:
+            value = (TUint32)((TInt32)aSample >> 8);
+            break;
+        default:
+            break;
+    }
+
+    for (TUint i = 0; i < bytes; i++)
+    {
+        *aDst++ = (TByte)(value >> (i * 8));
+    }
+
+    return aDst;
+}
+
+static void ReferenceConvert(const TByte* aSrc, TUint aSourceBytes,
+                             snd_pcm_format_t aFormat, PcmChannelMap aMap,
+                             TByte* aDst, TUint aSubsamples)
+{
+    for (TUint i = 0; i < aSubsamples; i++)
+    {
+        const TUint32 sample = ReferenceRead(aSrc + i * aSourceBytes,
+                                             aSourceBytes);
+
+        aDst = ReferenceWrite(sample, aFormat, aDst);
+
+        if (aMap == ePcmMonoToStereo)
+        {
+            aDst = ReferenceWrite(sample, aFormat, aDst);
+        }
+    }
+}
+
+static TUint OutputBytes(snd_pcm_format_t aFormat)
+{
+    return (aFormat == SND_PCM_FORMAT_S16_LE)   ? 2 :
+           (aFormat == SND_PCM_FORMAT_S24_3LE)  ? 3 : 4;
+}
+
+
+// CycleCounter
+
+class CycleCounter
+{
+public:
+    CycleCounter();
+    ~CycleCounter();
+    const TChar* Name() const;
+    TUint64      Read() const;
+private:
+    TInt         iFd;
+    const TChar* iName;
+};
+
+CycleCounter::CycleCounter()
+: iFd(-1)
+, iName("none")
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.size           = sizeof(attr);
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.config         = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+
+    iFd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+
+    if (iFd >= 0)
+    {
+        iName = "perf";
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    else
+    {
+        iName = "tsc";
+    }
+#endif
+}
+
+CycleCounter::~CycleCounter()
+{
+    if (iFd >= 0)
+    {
+        close(iFd);
+    }
+}
+
+const TChar* CycleCounter::Name() const
+{
+    return iName;
+}
+
+TUint64 CycleCounter::Read() const
+{
+    TUint64 cycles = 0;
+
+    if (iFd >= 0)
+    {
+        if (read(iFd, &cycles, sizeof(cycles)) != sizeof(cycles))
+        {
+            cycles = 0;
+        }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    else
+    {
+        cycles = __rdtsc();
+    }
+#endif
+
+    return cycles;
+}
+
+
+// Kernel tiers, each the scalar table overlaid with one extension's
+// kernels, as PcmKernels would build it on a CPU with only that extension.
+
+struct Tier
+{
+    const TChar* iName;
+    TBool      (*iFill)(PcmKernelTable& aTable);
+    TBool        iSupported;
+};
+
+static std::vector<Tier> Tiers()
+{
+    std::vector<Tier> tiers;
+
+    tiers.push_back({ "scalar", nullptr, true });
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    tiers.push_back({ "sse2",  PcmKernelsSse2,
+                      (TBool)__builtin_cpu_supports("sse2") });
+    tiers.push_back({ "ssse3", PcmKernelsSsse3,
+                      (TBool)__builtin_cpu_supports("ssse3") });
+    tiers.push_back({ "avx2",  PcmKernelsAvx2,
+                      (TBool)__builtin_cpu_supports("avx2") });
+#elif defined(__aarch64__)
+    tiers.push_back({ "neon", PcmKernelsNeon, true });
+#elif defined(__arm__)
+    tiers.push_back({ "neon", PcmKernelsNeon,
+                      (getauxval(AT_HWCAP) & HWCAP_NEON) != 0 });
+#endif
+
+    return tiers;
+}
+
+static TBool Check(PcmKernel aKernel, TUint aSourceBytes,
+                   snd_pcm_format_t aFormat, PcmChannelMap aMap,
+                   const TByte* aSrc, TByte* aDst, TByte* aExpected)
+{
+    const TUint copies = (aMap == ePcmMonoToStereo) ? 2 : 1;
+
+    for (TUint subsamples = 0; subsamples < kCheckLengths; subsamples++)
+    {
+        const TUint bytes = subsamples * copies * OutputBytes(aFormat);
+
+        memset(aDst, kGuard, bytes + kGuardBytes);
+        memset(aExpected, kGuard, bytes + kGuardBytes);
+
+        aKernel(aSrc, aDst, subsamples);
+        ReferenceConvert(aSrc, aSourceBytes, aFormat, aMap, aExpected,
+                         subsamples);
+
+        if (memcmp(aDst, aExpected, bytes + kGuardBytes) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int aArgc, char* aArgv[])
+{
+    const TChar* only = (aArgc > 1) ? aArgv[1] : nullptr;
+
+    std::vector<TByte> src(kMaxFrames * kMaxChannels * kPcmMaxSourceBytes);
+    std::vector<TByte> dst(kMaxFrames * kMaxChannels * 4 * 2 + kGuardBytes);
+    std::vector<TByte> expected(dst.size());
+
+    // Full scale noise exercises every bit of every byte.
+    srand(1);
+
+    for (TByte& b : src)
+    {
+        b = (TByte)rand();
+    }
+
+    CycleCounter counter;
+    TBool        exact = true;
+
+    printf("%-7s %3s %-9s %-7s %3s %6s %10s %12s %6s\n",
+           "kernel", "in", "out", "map", "ch", "frames", "MB/s",
+           "cycles/smp", "exact");
+
+    for (const Tier& tier : Tiers())
+    {
+        if (only != nullptr && strcmp(only, tier.iName) != 0)
+        {
+            continue;
+        }
+
+        PcmKernelTable table;
+        PcmKernelFiller<PcmScalar, 0, 0>::Fill(table);
+
+        PcmKernelTable scalar;
+        PcmKernelFiller<PcmScalar, 0, 0>::Fill(scalar);
+
+        if (!tier.iSupported ||
+            (tier.iFill != nullptr && !tier.iFill(table)))
+        {
+            printf("%-7s not available\n", tier.iName);
+            continue;
+        }
+
+        for (TUint s = 0; s < kPcmMaxSourceBytes; s++)
+        {
+            for (TUint f = 0; f < kPcmFormatCount; f++)
+            {
+                for (TUint m = 0; m < ePcmChannelMapCount; m++)
+                {
+                    const PcmKernel kernel = table[s][f][m];
+
+                    // Entries an extension leaves alone are the scalar
+                    // ones, already covered.
+                    if (tier.iFill != nullptr && kernel == scalar[s][f][m])
+                    {
+                        continue;
+                    }
+
+                    const PcmChannelMap    map    = (PcmChannelMap)m;
+                    const snd_pcm_format_t format = kPcmFormats[f];
+                    const TBool ok = Check(kernel, s + 1, format, map,
+                                           src.data(), dst.data(),
+                                           expected.data());
+
+                    exact = exact && ok;
+
+                    for (TUint channels : kChannels)
+                    {
+                        // Mono to stereo only ever has one input channel.
+                        if (map == ePcmMonoToStereo && channels != 1)
+                        {
+                            continue;
+                        }
+
+                        for (TUint frames : kFrames)
+                        {
+                            const TUint subsamples = frames * channels;
+                            const TUint copies =
+                                (map == ePcmMonoToStereo) ? 2 : 1;
+
+                            TUint64    iterations = 0;
+                            const auto start  = std::chrono::steady_clock::now();
+                            const TUint64 cycles = counter.Read();
+                            double     secs   = 0;
+
+                            do
+                            {
+                                for (TUint i = 0; i < 64; i++)
+                                {
+                                    kernel(src.data(), dst.data(), subsamples);
+                                }
+
+                                iterations += 64;
+                                secs = std::chrono::duration<double>(
+                                    std::chrono::steady_clock::now() -
+                                    start).count();
+                            } while (secs < kMinTimedSecs);
+
+                            const double elapsedCycles =
+                                (double)(counter.Read() - cycles);
+                            const double bytes =
+                                (double)iterations * subsamples * (s + 1);
+
+                            printf("%-7s %3u %-9s %-7s %3u %6u %10.1f ",
+                                   tier.iName, (s + 1) * 8,
+                                   snd_pcm_format_name(format),
+                                   (map == ePcmMonoToStereo) ? "mono>st" :
+                                                               "inter",
+                                   channels, frames, bytes / secs / 1e6);
+
+                            if (elapsedCycles > 0)
+                            {
+                                printf("%12.3f ", elapsedCycles /
+                                       ((double)iterations * subsamples *
+                                        copies));
+                            }
+                            else
+                            {
+                                printf("%12s ", "-");
+                            }
+
+                            printf("%6s\n", ok ? "yes" : "NO");
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    printf("cycles from %s\n", counter.Name());
+
+    if (!exact)
+    {
+        printf("FAIL: kernels differ from the reference conversion\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,555 @@
+// RenderBench
+//
+// Plays corpus files through a pipeline built as ExampleMediaPlayer builds
+// its own, with the same codecs, into DriverAlsa's full speed null sink.
+// For each format, taken from the file extension, it reports:
+//
+//   realtime   seconds of audio rendered per second of wall time
+//   cpu ms/s   process CPU time per second of audio
+//   peak rss   the process's high water mark by the end of the format
+//   allocs/s   heap allocations per second of audio
+//
+// The files are served over HTTP by a stand-in server on the loopback
+// interface, so they take the protocol path network streams take.
+//
+// Usage: RenderBench <file>...
+
+#include <OpenHome/Types.h>
+#include <OpenHome/Configuration/ConfigManager.h>
+#include <OpenHome/Configuration/Tests/ConfigRamStore.h>
+#include <OpenHome/Media/Codec/CodecFactory.h>
+#include <OpenHome/Media/Codec/ContainerFactory.h>
+#include <OpenHome/Media/MimeTypeList.h>
+#include <OpenHome/Media/PipelineManager.h>
+#include <OpenHome/Media/Protocol/ProtocolFactory.h>
+#include <OpenHome/Media/UriProviderSingleTrack.h>
+#include <OpenHome/Media/Utils/AllocatorInfoLogger.h>
+#include <OpenHome/Net/Core/OhNet.h>
+#include <OpenHome/Private/Printer.h>
+#include <OpenHome/Private/Shell.h>
+#include <OpenHome/SocketSsl.h>
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <netinet/in.h>
+#include <new>
+#include <string>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "ClockPullerAlsa.h"
+#include "DriverAlsa.h"
+#include "OptionalFeatures.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Configuration;
+using namespace OpenHome::Media;
+using namespace OpenHome::Net;
+
+
+// Every heap allocation in the process is counted.
+
+static std::atomic<TUint64> gAllocations(0);
+
+void* operator new(std::size_t aBytes)
+{
+    gAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    void* p = malloc(aBytes == 0 ? 1 : aBytes);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    return p;
+}
+
+void* operator new[](std::size_t aBytes)
+{
+    return operator new(aBytes);
+}
+
+void operator delete(void* aPtr) noexcept
+{
+    free(aPtr);
+}
+
+void operator delete[](void* aPtr) noexcept
+{
+    free(aPtr);
+}
+
+
+// CorpusServer
+//
+// Serves the corpus files as /0, /1, ... over HTTP/1.1 on the loopback
+// interface, each connection on its own thread. Ranges are honoured, as
+// containers seek to find their index.
+
+class CorpusServer
+{
+public:
+    CorpusServer(const std::vector<std::string>& aFiles);
+    ~CorpusServer();
+    void Uri(TUint aIndex, Bwx& aUri) const;
+private:
+    void Listen();
+    void Serve(TInt aSocket);
+private:
+    const std::vector<std::string>& iFiles;
+    TInt                            iListener;
+    TUint                           iPort;
+    std::thread                     iThread;
+    std::vector<std::thread>        iSessions;
+};
+
+CorpusServer::CorpusServer(const std::vector<std::string>& aFiles)
+: iFiles(aFiles)
+{
+    iListener = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT(iListener >= 0);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = 0;
+
+    socklen_t length = sizeof(addr);
+
+    if (bind(iListener, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(iListener, 8) != 0 ||
+        getsockname(iListener, (sockaddr *)&addr, &length) != 0)
+    {
+        ASSERTS();
+    }
+
+    iPort   = ntohs(addr.sin_port);
+    iThread = std::thread(&CorpusServer::Listen, this);
+}
+
+CorpusServer::~CorpusServer()
+{
+    shutdown(iListener, SHUT_RDWR);
+    close(iListener);
+    iThread.join();
+
+    for (std::thread& session : iSessions)
+    {
+        session.join();
+    }
+}
+
+void CorpusServer::Uri(TUint aIndex, Bwx& aUri) const
+{
+    aUri.Replace(Brn("http://127.0.0.1:"));
+    aUri.AppendPrintf("%u/%u", iPort, aIndex);
+}
+
+void CorpusServer::Listen()
+{
+    for (;;)
+    {
+        const TInt session = accept(iListener, nullptr, nullptr);
+
+        if (session < 0)
+        {
+            return;
+        }
+
+        iSessions.push_back(std::thread(&CorpusServer::Serve, this, session));
+    }
+}
+
+void CorpusServer::Serve(TInt aSocket)
+{
+    // Only the request line and a Range header matter, and both fit in
+    // the first read.
+    TChar         request[4096];
+    const ssize_t bytes  = recv(aSocket, request, sizeof(request) - 1, 0);
+    TUint         index  = 0;
+    TUint64       offset = 0;
+
+    request[(bytes > 0) ? bytes : 0] = '\0';
+
+    if (sscanf(request, "GET /%u", &index) != 1 || index >= iFiles.size())
+    {
+        close(aSocket);
+        return;
+    }
+
+    const TChar* range = strstr(request, "Range: bytes=");
+    if (range != nullptr)
+    {
+        offset = strtoull(range + strlen("Range: bytes="), nullptr, 10);
+    }
+
+    std::ifstream file(iFiles[index], std::ios::binary | std::ios::ate);
+
+    if (!file)
+    {
+        const TChar notFound[] = "HTTP/1.1 404 Not Found\r\n"
+                                 "Content-Length: 0\r\n"
+                                 "Connection: close\r\n\r\n";
+        send(aSocket, notFound, sizeof(notFound) - 1, MSG_NOSIGNAL);
+        close(aSocket);
+        return;
+    }
+
+    const TUint64 size = file.tellg();
+
+    if (offset > size)
+    {
+        offset = size;
+    }
+
+    TChar header[256];
+    TInt  headerBytes;
+
+    if (range != nullptr)
+    {
+        headerBytes = snprintf(header, sizeof(header),
+                               "HTTP/1.1 206 Partial Content\r\n"
+                               "Content-Length: %llu\r\n"
+                               "Content-Range: bytes %llu-%llu/%llu\r\n"
+                               "Connection: close\r\n\r\n",
+                               (unsigned long long)(size - offset),
+                               (unsigned long long)offset,
+                               (unsigned long long)(size - 1),
+                               (unsigned long long)size);
+    }
+    else
+    {
+        headerBytes = snprintf(header, sizeof(header),
+                               "HTTP/1.1 200 OK\r\n"
+                               "Content-Length: %llu\r\n"
+                               "Accept-Ranges: bytes\r\n"
+                               "Connection: close\r\n\r\n",
+                               (unsigned long long)size);
+    }
+
+    TBool ok = (send(aSocket, header, headerBytes, MSG_NOSIGNAL) == headerBytes);
+
+    file.seekg(offset);
+
+    // The pipeline reads at its own pace, and hangs up when it has what it
+    // wants.
+    TChar buffer[64 * 1024];
+
+    while (ok && file)
+    {
+        file.read(buffer, sizeof(buffer));
+
+        const ssize_t read = file.gcount();
+        ok = (read > 0 && send(aSocket, buffer, read, MSG_NOSIGNAL) == read);
+    }
+
+    close(aSocket);
+}
+
+
+// RenderObserver
+//
+// Waits for each track to play out, noting how much audio it held.
+
+class RenderObserver : public IPipelineObserver
+{
+public:
+    RenderObserver();
+    void   Begin();
+    TBool  WaitForEnd(TUint aTimeoutMs);
+    double AudioSeconds() const;
+private: // from IPipelineObserver
+    void NotifyPipelineState(EPipelineState aState) override;
+    void NotifyMode(const Brx& aMode, const ModeInfo& aInfo,
+                    const ModeTransportControls& aTransportControls) override;
+    void NotifyTrack(Track& aTrack, TBool aStartOfStream) override;
+    void NotifyMetaText(const Brx& aText) override;
+    void NotifyTime(TUint aSeconds) override;
+    void NotifyStreamInfo(const DecodedStreamInfo& aStreamInfo) override;
+private:
+    Semaphore            iEnded;
+    std::atomic<TBool>   iPlaying;
+    std::atomic<TUint64> iJiffies;
+};
+
+RenderObserver::RenderObserver()
+: iEnded("REND", 0)
+, iPlaying(false)
+, iJiffies(0)
+{
+}
+
+void RenderObserver::Begin()
+{
+    iEnded.Clear();
+    iPlaying = false;
+    iJiffies = 0;
+}
+
+TBool RenderObserver::WaitForEnd(TUint aTimeoutMs)
+{
+    try
+    {
+        iEnded.Wait(aTimeoutMs);
+    }
+    catch (Timeout&)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+double RenderObserver::AudioSeconds() const
+{
+    return (double)iJiffies / Jiffies::kPerSecond;
+}
+
+void RenderObserver::NotifyPipelineState(EPipelineState aState)
+{
+    if (aState == EPipelinePlaying)
+    {
+        iPlaying = true;
+    }
+    else if (aState == EPipelineStopped && iPlaying.exchange(false))
+    {
+        iEnded.Signal();
+    }
+}
+
+void RenderObserver::NotifyMode(const Brx& /*aMode*/,
+                                const ModeInfo& /*aInfo*/,
+                                const ModeTransportControls& /*aTransportControls*/)
+{
+}
+
+void RenderObserver::NotifyTrack(Track& /*aTrack*/, TBool /*aStartOfStream*/)
+{
+}
+
+void RenderObserver::NotifyMetaText(const Brx& /*aText*/)
+{
+}
+
+void RenderObserver::NotifyTime(TUint /*aSeconds*/)
+{
+}
+
+void RenderObserver::NotifyStreamInfo(const DecodedStreamInfo& aStreamInfo)
+{
+    iJiffies += aStreamInfo.TrackLength();
+}
+
+
+// NullVolume
+//
+// Nothing to ramp or mute.
+
+class NullVolume : public IVolumeRamper, public IVolumeMuterStepped
+{
+private: // from IVolumeRamper
+    void ApplyVolumeMultiplier(TUint /*aValue*/) override {}
+private: // from IVolumeMuterStepped
+    Status BeginMute() override { return Status::eComplete; }
+    Status StepMute(TUint /*aJiffies*/) override { return Status::eComplete; }
+    void SetMuted() override {}
+    Status BeginUnmute() override { return Status::eComplete; }
+    Status StepUnmute(TUint /*aJiffies*/) override { return Status::eComplete; }
+    void SetUnmuted() override {}
+};
+
+
+// FormatResult
+
+struct FormatResult
+{
+    FormatResult() : iFiles(0), iAudioSecs(0), iWallSecs(0), iCpuSecs(0),
+                     iAllocations(0), iPeakRssKb(0) {}
+
+    TUint   iFiles;
+    double  iAudioSecs;
+    double  iWallSecs;
+    double  iCpuSecs;
+    TUint64 iAllocations;
+    long    iPeakRssKb;
+};
+
+static double CpuSeconds(const rusage& aUsage)
+{
+    return aUsage.ru_utime.tv_sec + aUsage.ru_utime.tv_usec / 1e6 +
+           aUsage.ru_stime.tv_sec + aUsage.ru_stime.tv_usec / 1e6;
+}
+
+// As ExampleMediaPlayer::RegisterPlugins().
+static void RegisterCodecs(PipelineManager& aPipeline,
+                           IMimeTypeList& aMimeTypes)
+{
+#ifndef USE_LIBAVCODEC
+    aPipeline.Add(Codec::ContainerFactory::NewId3v2());
+    aPipeline.Add(Codec::ContainerFactory::NewMpeg4(aMimeTypes));
+#endif // USE_LIBAVCODEC
+    aPipeline.Add(Codec::ContainerFactory::NewMpegTs(aMimeTypes));
+
+    aPipeline.Add(Codec::CodecFactory::NewFlac(aMimeTypes));
+    aPipeline.Add(Codec::CodecFactory::NewWav(aMimeTypes));
+    aPipeline.Add(Codec::CodecFactory::NewAiff(aMimeTypes));
+    aPipeline.Add(Codec::CodecFactory::NewAifc(aMimeTypes));
+#ifdef USE_LIBAVCODEC
+#if defined (ENABLE_AAC) || defined (ENABLE_MP3)
+    aPipeline.Add(Codec::CodecFactory::NewMp3(aMimeTypes));
+#endif // ENABLE_AAC || ENABLE_MP3
+#else // USE_LIBAVCODEC
+#ifdef ENABLE_AAC
+    aPipeline.Add(Codec::CodecFactory::NewAacFdkMp4(aMimeTypes));
+    aPipeline.Add(Codec::CodecFactory::NewAacFdkAdts(aMimeTypes));
+#endif // ENABLE_AAC
+#ifdef ENABLE_MP3
+    aPipeline.Add(Codec::CodecFactory::NewMp3(aMimeTypes));
+#endif // ENABLE_MP3
+#endif // USE_LIBAVCODEC
+    aPipeline.Add(Codec::CodecFactory::NewAlacApple(aMimeTypes));
+    aPipeline.Add(Codec::CodecFactory::NewPcm());
+    aPipeline.Add(Codec::CodecFactory::NewVorbis(aMimeTypes));
+}
+
+int main(int aArgc, char* aArgv[])
+{
+    static const TUint kTrackTimeoutMs = 10 * 60 * 1000;
+
+    if (aArgc < 2)
+    {
+        fprintf(stderr, "Usage: %s <file>...\n", aArgv[0]);
+        return 1;
+    }
+
+    const std::vector<std::string> files(aArgv + 1, aArgv + aArgc);
+
+    InitialisationParams* initParams = InitialisationParams::Create();
+    initParams->SetUseLoopbackNetworkAdapter();
+
+    Library*     lib = new Library(initParams);
+    Environment& env = lib->Env();
+
+    Shell*              shell = new Shell(env, 0);
+    ConfigRamStore      store;
+    ConfigManager       configManager(store);
+    AllocatorInfoLogger infoLogger;
+    TrackFactory        trackFactory(infoLogger, 5);
+    MimeTypeList        mimeTypes;
+    SslContext          ssl;
+    ClockPullerAlsa     clockPuller;
+    RenderObserver      observer;
+    NullVolume          volume;
+
+    PipelineInitParams* pipelineInit = PipelineInitParams::New();
+    pipelineInit->SetThreadPriorityMax(kPriorityHighest);
+
+    PipelineManager* pipeline =
+        new PipelineManager(pipelineInit, infoLogger, trackFactory);
+    UriProviderSingleTrack* uriProvider =
+        new UriProviderSingleTrack("Bench", false, false, trackFactory);
+
+    RegisterCodecs(*pipeline, mimeTypes);
+    pipeline->Add(ProtocolFactory::NewHttp(env, ssl, Brx::Empty()));
+    pipeline->Add(uriProvider);
+    pipeline->AddObserver(observer);
+
+    DriverAlsa* driver = new DriverAlsa(*pipeline, *shell, store,
+                                        configManager, clockPuller,
+                                        Brn("sink:null,fast"), 20000, 50000);
+
+    pipeline->Start(volume, volume);
+
+    std::map<std::string, FormatResult> results;
+
+    {
+        CorpusServer server(files);
+
+        for (TUint i = 0; i < files.size(); i++)
+        {
+            const std::string::size_type dot = files[i].rfind('.');
+            const std::string format =
+                (dot == std::string::npos) ? "?" : files[i].substr(dot + 1);
+
+            Bws<Uri::kMaxUriBytes> uri;
+            server.Uri(i, uri);
+
+            observer.Begin();
+
+            Track* track = uriProvider->SetTrack(uri, Brx::Empty());
+            pipeline->Begin(uriProvider->Mode(), track->Id());
+            track->RemoveRef();
+
+            rusage before;
+            getrusage(RUSAGE_SELF, &before);
+
+            const TUint64 allocations = gAllocations;
+            const auto    start       = std::chrono::steady_clock::now();
+
+            pipeline->Play();
+
+            if (!observer.WaitForEnd(kTrackTimeoutMs))
+            {
+                Log::Print("RenderBench: %s did not finish\n",
+                           files[i].c_str());
+                pipeline->Stop();
+                continue;
+            }
+
+            const double wall = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+
+            rusage after;
+            getrusage(RUSAGE_SELF, &after);
+
+            FormatResult& result = results[format];
+
+            result.iFiles++;
+            result.iAudioSecs   += observer.AudioSeconds();
+            result.iWallSecs    += wall;
+            result.iCpuSecs     += CpuSeconds(after) - CpuSeconds(before);
+            result.iAllocations += gAllocations - allocations;
+            result.iPeakRssKb    = after.ru_maxrss;
+        }
+
+        pipeline->Quit();
+    }
+
+    delete driver;
+    delete pipeline;
+
+    printf("%-8s %5s %10s %10s %10s %12s %12s\n", "format", "files",
+           "audio s", "realtime", "cpu ms/s", "peak rss MB", "allocs/s");
+
+    for (const auto& entry : results)
+    {
+        const FormatResult& r = entry.second;
+
+        if (r.iAudioSecs <= 0 || r.iWallSecs <= 0)
+        {
+            continue;
+        }
+
+        printf("%-8s %5u %10.1f %10.1f %10.2f %12.1f %12.1f\n",
+               entry.first.c_str(), r.iFiles, r.iAudioSecs,
+               r.iAudioSecs / r.iWallSecs,
+               (r.iCpuSecs * 1000) / r.iAudioSecs,
+               r.iPeakRssKb / 1024.0,
+               r.iAllocations / r.iAudioSecs);
+    }
+
+    delete shell;
+    delete lib;
+
+    return 0;
+}